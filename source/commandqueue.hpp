@@ -0,0 +1,130 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Bounded multi-producer single-consumer queue (Dmitry Vyukov's design) of
+// command lines. Each slot carries a sequence number telling producers and the
+// consumer whose turn it is, so producers only contend on the enqueue position
+// and never block. Lines are stored with a terminating line break, commands
+// that don't fit in MaxLength with it are dropped.
+// Nothing here depends on the engine, so it can be tested standalone.
+template<size_t Capacity, size_t MaxLength>
+class CommandQueue
+{
+public:
+	CommandQueue( ) :
+		enqueue_position( 0 ),
+		dequeue_position( 0 ),
+		accepting( false ),
+		submitted( 0 ),
+		dropped( 0 )
+	{ }
+
+	// Empties the queue and starts accepting commands, no producer may be
+	// pushing meanwhile.
+	void Open( )
+	{
+		for( size_t k = 0; k < Capacity; ++k )
+			slots[k].sequence.store( k, std::memory_order_relaxed );
+
+		enqueue_position.store( 0, std::memory_order_relaxed );
+		dequeue_position = 0;
+		accepting.store( true, std::memory_order_release );
+	}
+
+	void Close( )
+	{
+		accepting.store( false, std::memory_order_release );
+	}
+
+	// Any thread, returns false (and counts the command as dropped) when the
+	// queue is closed or full, or the command too long.
+	bool Push( const char *command )
+	{
+		const size_t length = std::strlen( command );
+		if( !accepting.load( std::memory_order_acquire ) || length + 2 > MaxLength )
+		{
+			dropped.fetch_add( 1, std::memory_order_relaxed );
+			return false;
+		}
+
+		Slot *slot;
+		size_t position = enqueue_position.load( std::memory_order_relaxed );
+		for( ; ; )
+		{
+			slot = &slots[position % Capacity];
+			const size_t sequence = slot->sequence.load( std::memory_order_acquire );
+			const intptr_t difference = static_cast<intptr_t>( sequence ) - static_cast<intptr_t>( position );
+			if( difference == 0 )
+			{
+				if( enqueue_position.compare_exchange_weak( position, position + 1, std::memory_order_relaxed ) )
+					break;
+			}
+			else if( difference < 0 )
+			{
+				dropped.fetch_add( 1, std::memory_order_relaxed );
+				return false;
+			}
+			else
+			{
+				position = enqueue_position.load( std::memory_order_relaxed );
+			}
+		}
+
+		std::memcpy( slot->command, command, length );
+		slot->command[length] = '\n';
+		slot->command[length + 1] = '\0';
+		slot->sequence.store( position + 1, std::memory_order_release );
+		submitted.fetch_add( 1, std::memory_order_relaxed );
+		return true;
+	}
+
+	// Consumer thread only, hands every queued line to consumer( line ) and
+	// returns how many there were. Stops after a full queue's worth, so
+	// producers that keep up can't keep it here forever.
+	template<typename Consumer>
+	size_t Drain( Consumer consumer )
+	{
+		size_t count = 0;
+		for( ; count < Capacity; ++count )
+		{
+			Slot &slot = slots[dequeue_position % Capacity];
+			if( slot.sequence.load( std::memory_order_acquire ) != dequeue_position + 1 )
+				break;
+
+			consumer( static_cast<const char *>( slot.command ) );
+
+			slot.sequence.store( dequeue_position + Capacity, std::memory_order_release );
+			++dequeue_position;
+		}
+
+		return count;
+	}
+
+	uint64_t Submitted( ) const
+	{
+		return submitted.load( std::memory_order_relaxed );
+	}
+
+	uint64_t Dropped( ) const
+	{
+		return dropped.load( std::memory_order_relaxed );
+	}
+
+private:
+	struct Slot
+	{
+		std::atomic<size_t> sequence;
+		char command[MaxLength];
+	};
+
+	Slot slots[Capacity];
+	std::atomic<size_t> enqueue_position;
+	size_t dequeue_position;
+	std::atomic<bool> accepting;
+	std::atomic<uint64_t> submitted;
+	std::atomic<uint64_t> dropped;
+};
@@ -0,0 +1,200 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+// Matches names against a list of case-insensitive glob patterns ('*' matches
+// any run of characters, '?' any single one), reporting the first pattern that
+// matches. The patterns are compiled into a DFA by subset construction, so
+// matching costs one table lookup per character of the name, however many
+// patterns there are.
+// Nothing here depends on the engine, so it can be tested standalone.
+class GlobAutomaton
+{
+public:
+	enum : uint32_t
+	{
+		no_match = ~0u
+	};
+
+	explicit GlobAutomaton( size_t limit ) :
+		max_states( limit ),
+		class_count( 1 ),
+		start( dead )
+	{
+		std::memset( classes, 0, sizeof( classes ) );
+	}
+
+	// Replaces the patterns. Fails, keeping the previous ones, when the DFA
+	// would need more than max_states states.
+	bool Compile( const std::vector<std::string> &patterns )
+	{
+		Positions positions;
+		std::vector<uint32_t> initial;
+		uint8_t next_classes[256] = { 0 };
+		size_t next_class_count = 1;
+		// one lowercase byte per class to step the NFA with, class 0 stands for
+		// the bytes no pattern mentions and only wildcards take those
+		std::vector<uint8_t> representatives( 1, 0 );
+		for( size_t p = 0; p < patterns.size( ); ++p )
+		{
+			initial.push_back( static_cast<uint32_t>( positions.symbol.size( ) ) );
+
+			const std::string &pattern = patterns[p];
+			for( size_t k = 0; k < pattern.size( ); ++k )
+			{
+				const char symbol = static_cast<char>( ToLower( static_cast<uint8_t>( pattern[k] ) ) );
+				if( symbol == '*' && k != 0 && pattern[k - 1] == '*' )
+					continue;
+
+				positions.pattern.push_back( static_cast<uint32_t>( p ) );
+				positions.symbol.push_back( symbol );
+
+				const uint8_t byte = static_cast<uint8_t>( symbol );
+				if( symbol != '*' && symbol != '?' && next_classes[byte] == 0 )
+				{
+					next_classes[byte] = static_cast<uint8_t>( next_class_count++ );
+					representatives.push_back( byte );
+					if( byte >= 'a' && byte <= 'z' )
+						next_classes[byte - 'a' + 'A'] = next_classes[byte];
+				}
+			}
+
+			positions.pattern.push_back( static_cast<uint32_t>( p ) );
+			positions.symbol.push_back( '\0' );
+		}
+
+		std::map<std::vector<uint32_t>, uint32_t> states;
+		std::vector<std::vector<uint32_t>> sets;
+		std::vector<uint32_t> next_transitions, next_accepts;
+
+		sets.push_back( std::vector<uint32_t>( ) );
+		states[sets.back( )] = dead;
+		next_transitions.assign( next_class_count, dead );
+		next_accepts.push_back( no_match );
+
+		Closure( positions, initial );
+		sets.push_back( initial );
+		states[initial] = 1;
+		next_transitions.resize( next_transitions.size( ) + next_class_count, dead );
+		next_accepts.push_back( no_match );
+
+		std::vector<uint32_t> target;
+		for( size_t state = 1; state < sets.size( ); ++state )
+		{
+			for( size_t k = 0; k < sets[state].size( ); ++k )
+			{
+				const uint32_t position = sets[state][k];
+				if( positions.symbol[position] == '\0' && positions.pattern[position] < next_accepts[state] )
+					next_accepts[state] = positions.pattern[position];
+			}
+
+			for( size_t c = 0; c < next_class_count; ++c )
+			{
+				target.clear( );
+				for( size_t k = 0; k < sets[state].size( ); ++k )
+				{
+					const uint32_t position = sets[state][k];
+					const char symbol = positions.symbol[position];
+					if( symbol == '*' )
+						target.push_back( position );
+					else if( symbol == '?' || ( symbol != '\0' && c != 0 &&
+						static_cast<uint8_t>( symbol ) == representatives[c] ) )
+						target.push_back( position + 1 );
+				}
+
+				Closure( positions, target );
+
+				std::map<std::vector<uint32_t>, uint32_t>::iterator it = states.find( target );
+				uint32_t next;
+				if( it != states.end( ) )
+				{
+					next = it->second;
+				}
+				else
+				{
+					if( sets.size( ) >= max_states )
+						return false;
+
+					next = static_cast<uint32_t>( sets.size( ) );
+					states[target] = next;
+					sets.push_back( target );
+					next_transitions.resize( next_transitions.size( ) + next_class_count, dead );
+					next_accepts.push_back( no_match );
+				}
+
+				next_transitions[state * next_class_count + c] = next;
+			}
+		}
+
+		std::memcpy( classes, next_classes, sizeof( classes ) );
+		class_count = next_class_count;
+		transitions.swap( next_transitions );
+		accepts.swap( next_accepts );
+		start = patterns.empty( ) ? static_cast<uint32_t>( dead ) : 1;
+		return true;
+	}
+
+	// Returns the index of the first pattern matching the name, or no_match.
+	uint32_t Match( const char *name ) const
+	{
+		if( accepts.empty( ) )
+			return no_match;
+
+		uint32_t state = start;
+		for( ; *name != '\0' && state != dead; ++name )
+			state = transitions[state * class_count + classes[static_cast<uint8_t>( *name )]];
+
+		return accepts[state];
+	}
+
+	size_t States( ) const
+	{
+		return accepts.size( );
+	}
+
+private:
+	enum : uint32_t
+	{
+		dead = 0
+	};
+
+	// NFA positions are ( pattern, offset into it ) pairs numbered
+	// consecutively, with one extra position per pattern past its last
+	// character.
+	struct Positions
+	{
+		std::vector<uint32_t> pattern;
+		std::vector<char> symbol;
+	};
+
+	static uint8_t ToLower( uint8_t c )
+	{
+		return c >= 'A' && c <= 'Z' ? static_cast<uint8_t>( c - 'A' + 'a' ) : c;
+	}
+
+	static void Closure( const Positions &positions, std::vector<uint32_t> &set )
+	{
+		// a '*' may match nothing, so whatever follows it is reachable too
+		for( size_t k = 0; k < set.size( ); ++k )
+			if( positions.symbol[set[k]] == '*' )
+				set.push_back( set[k] + 1 );
+
+		std::sort( set.begin( ), set.end( ) );
+		set.erase( std::unique( set.begin( ), set.end( ) ), set.end( ) );
+	}
+
+	size_t max_states;
+	// byte to character class, bytes that appear in no pattern share class 0
+	uint8_t classes[256];
+	size_t class_count;
+	std::vector<uint32_t> transitions;
+	// for every state, the first pattern that is fully matched there
+	std::vector<uint32_t> accepts;
+	uint32_t start;
+};
@@ -200,7 +200,6 @@ public:
 	static int MaxCommandLength();
 	static characterset_t* DefaultBreakSet();
 
-private:
 	enum
 	{
 		COMMAND_MAX_ARGC = 64,
@@ -283,7 +282,7 @@ public:
 	// Invoke the function
 	virtual void Dispatch( const CCommand &command );
 
-private:
+public:
 	// NOTE: To maintain backward compat, we have to be very careful:
 	// All public virtual methods must appear in the same order always
 	// since engine code will be calling into this code, which *does not match*
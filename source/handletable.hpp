@@ -0,0 +1,90 @@
+#pragma once
+
+#include <pointermap.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Refers to objects through a slot and the generation the slot had when the
+// handle was made. The slot's generation is bumped when its object is
+// released, so a stale handle resolves to nullptr with one bounds check and
+// one compare instead of touching freed memory. Slots are reused, an object
+// acquired twice gets the same slot.
+template<typename Object>
+class HandleTable
+{
+public:
+	struct Handle
+	{
+		uint32_t slot;
+		uint32_t generation;
+	};
+
+	Handle Acquire( Object *object )
+	{
+		const uint32_t *found = lookup.Find( object );
+		if( found != nullptr )
+		{
+			Handle handle = { *found, slots[*found].generation };
+			return handle;
+		}
+
+		uint32_t slot;
+		if( !free_slots.empty( ) )
+		{
+			slot = free_slots.back( );
+			free_slots.pop_back( );
+		}
+		else
+		{
+			slot = static_cast<uint32_t>( slots.size( ) );
+			Slot fresh = { nullptr, 1 };
+			slots.push_back( fresh );
+		}
+
+		slots[slot].object = object;
+		lookup.Insert( object, slot );
+
+		Handle handle = { slot, slots[slot].generation };
+		return handle;
+	}
+
+	Object *Resolve( const Handle &handle ) const
+	{
+		if( handle.slot >= slots.size( ) || slots[handle.slot].generation != handle.generation )
+			return nullptr;
+
+		return slots[handle.slot].object;
+	}
+
+	void Release( Object *object )
+	{
+		const uint32_t *found = lookup.Find( object );
+		if( found == nullptr )
+			return;
+
+		Slot &slot = slots[*found];
+		slot.object = nullptr;
+		++slot.generation;
+		free_slots.push_back( *found );
+		lookup.Erase( object );
+	}
+
+	void Clear( )
+	{
+		slots.clear( );
+		free_slots.clear( );
+		lookup.Clear( );
+	}
+
+private:
+	struct Slot
+	{
+		Object *object;
+		uint32_t generation;
+	};
+
+	std::vector<Slot> slots;
+	std::vector<uint32_t> free_slots;
+	PointerMap<uint32_t> lookup;
+};
@@ -2,11 +2,36 @@
 #include <GarrysMod/Interfaces.hpp>
 #include <lua.hpp>
 #include <cstdint>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <new>
+#include <chrono>
+#include <atomic>
+#include <thread>
 #include <hackedconvar.h>
+#include <detouring/classproxy.hpp>
+#include <commandqueue.hpp>
+#include <globautomaton.hpp>
+#include <pointermap.hpp>
+#include <handletable.hpp>
+#include <nameindex.hpp>
+#include <trigramindex.hpp>
+
+#if defined _MSC_VER
+
+#include <intrin.h>
+
+#endif
 
 #if defined CONCOMMANDX_SERVER
 
 #include <eiface.h>
+#include <basehandle.h>
 
 #elif defined CONCOMMANDX_CLIENT
 
@@ -36,9 +61,12 @@ typedef IVEngineClient IVEngine;
 
 static ICvar *icvar = nullptr;
 static IVEngine *ivengine = nullptr;
+static GarrysMod::Lua::ILuaBase *lua = nullptr;
 
 static void Initialize( GarrysMod::Lua::ILuaBase *LUA )
 {
+	lua = LUA;
+
 	icvar = icvar_loader.GetInterface<ICvar>( CVAR_INTERFACE_VERSION );
 	if( icvar == nullptr )
 		LUA->ThrowError( "ICVar not initialized. Critical error." );
@@ -50,338 +78,4236 @@ static void Initialize( GarrysMod::Lua::ILuaBase *LUA )
 
 }
 
-namespace concommand
+namespace strings
 {
 
-struct Container
+// Interned strings for names and help texts set from Lua, which the engine
+// points at while they're set. They're deduplicated and reference counted,
+// each overridden name or help text holding a reference until it's replaced
+// or restored. Small strings are carved out of large arena blocks in size
+// classes, whose freed chunks are reused, big ones get an allocation of their
+// own. When the module closes, strings still referenced belong to commands
+// that went away with an override set, which may come back pointing at them,
+// so they and their blocks stay allocated. The rest is released.
+
+static const size_t block_size = 16384;
+static const size_t granularity = 16;
+static const size_t max_small = block_size / 4;
+
+struct Hash
 {
-	ConCommand *cmd;
-	const char *name_original;
-	char name[64];
-	const char *help_original;
-	char help[256];
+	size_t operator()( const char *text ) const
+	{
+		size_t hash = 2166136261u;
+		for( ; *text != '\0'; ++text )
+			hash = ( hash ^ static_cast<uint8_t>( *text ) ) * 16777619u;
+
+		return hash;
+	}
 };
 
-static const char *metaname = "concommand";
-static int32_t metatype = -1;
-static const char *invalid_error = "invalid concommand";
-static const char *table_name = "concommands_objects";
+struct Equal
+{
+	bool operator()( const char *a, const char *b ) const
+	{
+		return std::strcmp( a, b ) == 0;
+	}
+};
 
-inline void CheckType( GarrysMod::Lua::ILuaBase *LUA, int32_t index )
+static std::vector<char *> blocks;
+static size_t block_used = block_size;
+// freed chunks by size in granularity units
+static std::vector<char *> chunks[max_small / granularity + 1];
+static std::unordered_map<const char *, uint32_t, Hash, Equal> pool;
+// bumped whenever a string is freed, as its memory may come back holding
+// another one, for those who cache pointers
+static uint32_t released = 0;
+
+inline size_t Units( size_t size )
 {
-	if( !LUA->IsType( index, metatype ) )
-		LUA->TypeError( index, metaname );
+	return ( size + granularity - 1 ) / granularity;
 }
 
-inline Container *GetUserdata( GarrysMod::Lua::ILuaBase *LUA, int32_t index )
+static const char *Intern( const char *text )
 {
-	return LUA->GetUserType<Container>( index, metatype );
+	std::unordered_map<const char *, uint32_t, Hash, Equal>::iterator it = pool.find( text );
+	if( it != pool.end( ) )
+	{
+		++it->second;
+		return it->first;
+	}
+
+	const size_t size = std::strlen( text ) + 1;
+	char *copy;
+	if( size > max_small )
+	{
+		copy = new char[size];
+	}
+	else if( !chunks[Units( size )].empty( ) )
+	{
+		copy = chunks[Units( size )].back( );
+		chunks[Units( size )].pop_back( );
+	}
+	else
+	{
+		const size_t bytes = Units( size ) * granularity;
+		if( block_used + bytes > block_size )
+		{
+			blocks.push_back( new char[block_size] );
+			block_used = 0;
+		}
+
+		copy = blocks.back( ) + block_used;
+		block_used += bytes;
+	}
+
+	std::memcpy( copy, text, size );
+	pool.insert( std::make_pair( copy, 1u ) );
+	return copy;
 }
 
-static ConCommand *Get( GarrysMod::Lua::ILuaBase *LUA, int32_t index )
+// Drops a reference taken by Intern, nullptr is ignored.
+static void Release( const char *text )
 {
-	CheckType( LUA, index );
-	ConCommand *command = LUA->GetUserType<Container>( index, metatype )->cmd;
-	if( command == nullptr )
-		LUA->ArgError( index, invalid_error );
+	if( text == nullptr )
+		return;
 
-	return command;
+	std::unordered_map<const char *, uint32_t, Hash, Equal>::iterator it = pool.find( text );
+	if( it == pool.end( ) || it->first != text || --it->second != 0 )
+		return;
+
+	pool.erase( it );
+	++released;
+
+	const size_t size = std::strlen( text ) + 1;
+	char *copy = const_cast<char *>( text );
+	if( size > max_small )
+		delete[] copy;
+	else
+		chunks[Units( size )].push_back( copy );
 }
 
-inline void Push( GarrysMod::Lua::ILuaBase *LUA, ConCommand *command )
+static void Deinitialize( )
 {
-	if( command == nullptr )
+	std::vector<bool> referenced( blocks.size( ), false );
+	for( std::unordered_map<const char *, uint32_t, Hash, Equal>::iterator it = pool.begin( ); it != pool.end( ); ++it )
 	{
-		LUA->PushNil( );
-		return;
+		if( std::strlen( it->first ) + 1 > max_small )
+			continue;
+
+		for( size_t k = 0; k < blocks.size( ); ++k )
+			if( it->first >= blocks[k] && it->first < blocks[k] + block_size )
+			{
+				referenced[k] = true;
+				break;
+			}
 	}
 
-	LUA->GetField( GarrysMod::Lua::INDEX_REGISTRY, table_name );
-	LUA->PushUserdata( command );
-	LUA->GetTable( -2 );
-	if( LUA->IsType( -1, metatype ) )
+	pool.clear( );
+	for( size_t k = 0; k < max_small / granularity + 1; ++k )
+		chunks[k].clear( );
+
+	for( size_t k = 0; k < blocks.size( ); ++k )
+		if( !referenced[k] )
+			delete[] blocks[k];
+
+	blocks.clear( );
+	block_used = block_size;
+}
+
+}
+
+namespace registry
+{
+
+// Name index over the engine's ConCommand list, so lookups don't have to walk
+// every ConCommandBase with case-insensitive compares like ICvar::FindCommand.
+// ICvar prepends new registrations to its list, so a different list head (or
+// a hit on a command that was unregistered meanwhile) means the index is stale.
+// Full list consumers use Verify, which also catches unregistrations anywhere
+// in the list by comparing a signature of the m_pNext chain, unless the ICvar
+// hooks are tracking them.
+// Commands get a dense ID (their position in the commands vector) and each
+// FCVAR bit has a bitset over those IDs, for queries by flags.
+// A copy of the commands sorted by name serves prefix searches. Renames and
+// removals made by this module update the structures in place instead of
+// forcing a full rebuild.
+
+static NameIndex<ConCommand> names;
+static std::vector<ConCommand *> commands;
+static std::vector<ConCommand *> sorted;
+static PointerMap<uint32_t> ids;
+static std::vector<uint32_t> live_bits;
+static std::vector<uint32_t> flag_bits[32];
+static ConCommandBase *head = nullptr;
+static uintptr_t signature = 0;
+static bool dirty = true;
+static uint32_t generation = 0;
+// set while the ICvar hooks report every (un)registration, Verify then trusts
+// dirty and skips walking the list for a signature
+static bool tracked = false;
+
+inline uint8_t ToLower( uint8_t c )
+{
+	return NameIndex<ConCommand>::ToLower( c );
+}
+
+inline uintptr_t Signature( ConCommandBase *base )
+{
+	uintptr_t sig = 0;
+	for( ; base != nullptr; base = base->m_pNext )
+		sig = sig * 31 + reinterpret_cast<uintptr_t>( base );
+
+	return sig;
+}
+
+inline int32_t CompareNames( const char *a, const char *b )
+{
+	for( ; ; ++a, ++b )
 	{
-		LUA->Remove( -2 );
-		return;
+		const uint8_t ca = ToLower( static_cast<uint8_t>( *a ) );
+		const uint8_t cb = ToLower( static_cast<uint8_t>( *b ) );
+		if( ca != cb || ca == '\0' )
+			return static_cast<int32_t>( ca ) - static_cast<int32_t>( cb );
 	}
+}
 
-	LUA->Pop( 1 );
-
-	Container *udata = LUA->NewUserType<Container>( metatype );
-	udata->cmd = command;
-	udata->name_original = command->m_pszName;
-	udata->help_original = command->m_pszHelpString;
+inline bool HasPrefix( const char *name, const char *prefix )
+{
+	for( ; *prefix != '\0'; ++name, ++prefix )
+		if( ToLower( static_cast<uint8_t>( *name ) ) != ToLower( static_cast<uint8_t>( *prefix ) ) )
+			return false;
 
-	LUA->PushMetaTable( metatype );
-	LUA->SetMetaTable( -2 );
+	return true;
+}
 
-	LUA->CreateTable( );
-	LUA->SetFEnv( -2 );
+inline bool NameLess( const ConCommand *a, const ConCommand *b )
+{
+	return CompareNames( a->m_pszName, b->m_pszName ) < 0;
+}
 
-	LUA->PushUserdata( command );
-	LUA->Push( -2 );
-	LUA->SetTable( -4 );
-	LUA->Remove( -2 );
+inline bool NameLessThan( const ConCommand *command, const char *name )
+{
+	return CompareNames( command->m_pszName, name ) < 0;
 }
 
-inline ConCommand *Destroy( GarrysMod::Lua::ILuaBase *LUA, int32_t index )
+static void Rebuild( )
 {
-	Container *udata = GetUserdata( LUA, 1 );
-	ConCommand *command = udata->cmd;
-	if( command == nullptr )
-		return nullptr;
+	commands.clear( );
+	head = global::icvar->GetCommands( );
+	for( ConCommandBase *base = head; base != nullptr; base = base->m_pNext )
+		if( base->IsCommand( ) )
+			commands.push_back( static_cast<ConCommand *>( base ) );
 
-	LUA->GetField( GarrysMod::Lua::INDEX_REGISTRY, table_name );
-	LUA->PushUserdata( command );
-	LUA->PushNil( );
-	LUA->SetTable( -3 );
-	LUA->Pop( 1 );
+	names.Rebuild( commands );
 
-	command->m_pszName = udata->name_original;
-	command->m_pszHelpString = udata->help_original;
-	udata->cmd = nullptr;
+	sorted = commands;
+	std::stable_sort( sorted.begin( ), sorted.end( ), NameLess );
 
-	return command;
+	const size_t words = ( commands.size( ) + 31 ) / 32;
+	ids.Clear( );
+	live_bits.assign( words, 0 );
+	for( size_t bit = 0; bit < 32; ++bit )
+		flag_bits[bit].assign( words, 0 );
+
+	for( size_t id = 0; id < commands.size( ); ++id )
+	{
+		ids.Insert( commands[id], static_cast<uint32_t>( id ) );
+
+		const uint32_t word = static_cast<uint32_t>( id / 32 ), bitmask = 1u << ( id % 32 );
+		live_bits[word] |= bitmask;
+
+		const uint32_t flags = static_cast<uint32_t>( commands[id]->m_nFlags );
+		for( size_t bit = 0; bit < 32; ++bit )
+			if( ( flags & ( 1u << bit ) ) != 0 )
+				flag_bits[bit][word] |= bitmask;
+	}
+
+	signature = Signature( head );
+	dirty = false;
+	++generation;
 }
 
-LUA_FUNCTION_STATIC( gc )
+inline void Invalidate( )
 {
-	if( !LUA->IsType( 1, metatype ) )
-		return 0;
+	dirty = true;
+}
 
-	Destroy( LUA, 1 );
-	return 0;
+inline void Validate( )
+{
+	if( dirty || global::icvar->GetCommands( ) != head )
+		Rebuild( );
 }
 
-LUA_FUNCTION_STATIC( eq )
+inline void Verify( )
 {
-	LUA->PushBool( Get( LUA, 1 ) == Get( LUA, 2 ) );
-	return 1;
+	if( dirty || global::icvar->GetCommands( ) != head || ( !tracked && Signature( head ) != signature ) )
+		Rebuild( );
 }
 
-LUA_FUNCTION_STATIC( tostring )
+inline void Track( bool enable )
 {
-	LUA->PushFormattedString( "%s: %p", metaname, Get( LUA, 1 ) );
-	return 1;
+	tracked = enable;
+	dirty = true;
 }
 
-LUA_FUNCTION_STATIC( index )
+// Drops the command from the name index and the sorted names, before its
+// name changes or it goes away.
+static void EraseName( ConCommand *command )
 {
-	LUA->GetMetaTable( 1 );
-	LUA->Push( 2 );
-	LUA->RawGet( -2 );
-	if( !LUA->IsType( -1, GarrysMod::Lua::Type::NIL ) )
-		return 1;
+	if( dirty )
+		return;
 
-	LUA->Pop( 2 );
+	const char *name = command->m_pszName;
+	const bool indexed = names.Erase( command );
 
-	LUA->GetFEnv( 1 );
-	LUA->Push( 2 );
-	LUA->RawGet( -2 );
-	return 1;
+	std::vector<ConCommand *>::iterator it = std::lower_bound(
+		sorted.begin( ), sorted.end( ), name, NameLessThan
+	);
+	for( ; it != sorted.end( ) && CompareNames( ( *it )->m_pszName, name ) == 0; ++it )
+		if( *it == command )
+		{
+			it = sorted.erase( it );
+			break;
+		}
+
+	// another command with the same name can be found now
+	if( indexed )
+		for( it = std::lower_bound( sorted.begin( ), sorted.end( ), name, NameLessThan );
+			it != sorted.end( ) && CompareNames( ( *it )->m_pszName, name ) == 0; ++it )
+			if( *it != command )
+			{
+				names.Insert( *it );
+				break;
+			}
 }
 
-LUA_FUNCTION_STATIC( newindex )
+// Adds the command to the name index and the sorted names under its current name.
+static void InsertName( ConCommand *command )
 {
-	LUA->GetFEnv( 1 );
-	LUA->Push( 2 );
-	LUA->Push( 3 );
-	LUA->RawSet( -3 );
-	return 0;
+	if( dirty )
+		return;
+
+	names.Insert( command );
+
+	sorted.insert(
+		std::upper_bound( sorted.begin( ), sorted.end( ), command, NameLess ),
+		command
+	);
 }
 
-LUA_FUNCTION_STATIC( GetName )
+// Called after this module unregistered the command, which must have been
+// registered when the registry was last verified.
+static void Remove( ConCommand *command )
 {
-	LUA->PushString( Get( LUA, 1 )->GetName( ) );
-	return 1;
+	if( dirty )
+		return;
+
+	const uint32_t *found = ids.Find( command );
+	if( found == nullptr )
+		return;
+
+	EraseName( command );
+
+	const uint32_t id = *found, last = static_cast<uint32_t>( commands.size( ) - 1 );
+	const uint32_t word = id / 32, bitmask = 1u << ( id % 32 );
+	const uint32_t last_word = last / 32, last_bitmask = 1u << ( last % 32 );
+	if( id != last )
+	{
+		commands[id] = commands[last];
+		ids.Insert( commands[id], id );
+
+		for( size_t bit = 0; bit < 32; ++bit )
+		{
+			std::vector<uint32_t> &bits = flag_bits[bit];
+			if( ( bits[last_word] & last_bitmask ) != 0 )
+				bits[word] |= bitmask;
+			else
+				bits[word] &= ~bitmask;
+		}
+	}
+
+	live_bits[last_word] &= ~last_bitmask;
+	for( size_t bit = 0; bit < 32; ++bit )
+		flag_bits[bit][last_word] &= ~last_bitmask;
+
+	commands.pop_back( );
+	ids.Erase( command );
+
+	head = global::icvar->GetCommands( );
+	if( !tracked )
+		signature = Signature( head );
+
+	++generation;
 }
 
-LUA_FUNCTION_STATIC( SetName )
+static void FindByPrefix( const char *prefix, size_t limit, std::vector<ConCommand *> &matches )
 {
-	Container *udata = GetUserdata( LUA, 1 );
-	ConCommand *command = udata->cmd;
-	if( command == nullptr )
-		LUA->ThrowError( invalid_error );
+	Validate( );
 
-	V_strncpy( udata->name, LUA->CheckString( 2 ), sizeof( udata->name ) );
-	command->m_pszName = udata->name;
+	for( bool retried = false; ; retried = true )
+	{
+		matches.clear( );
 
-	return 0;
+		bool stale = false;
+		std::vector<ConCommand *>::const_iterator it = std::lower_bound(
+			sorted.begin( ), sorted.end( ), prefix, NameLessThan
+		);
+		for( ; it != sorted.end( ) && HasPrefix( ( *it )->m_pszName, prefix ); ++it )
+		{
+			if( !( *it )->m_bRegistered )
+			{
+				stale = true;
+				break;
+			}
+
+			if( limit != 0 && matches.size( ) >= limit )
+				break;
+
+			matches.push_back( *it );
+		}
+
+		if( !stale || retried )
+			return;
+
+		Rebuild( );
+	}
 }
 
-LUA_FUNCTION_STATIC( SetFlags )
+static ConCommand *Find( const char *name )
 {
-	Get( LUA, 1 )->m_nFlags = static_cast<int32_t>( LUA->CheckNumber( 2 ) );
-	return 0;
+	Validate( );
+
+	ConCommand *command = names.Find( name );
+	if( command != nullptr && !command->m_bRegistered )
+	{
+		Rebuild( );
+		command = names.Find( name );
+	}
+
+	return command;
 }
 
-LUA_FUNCTION_STATIC( GetFlags )
+// Case-insensitive glob match supporting '*' and '?'.
+static bool GlobMatch( const char *pattern, const char *name )
 {
-	LUA->PushNumber( Get( LUA, 1 )->m_nFlags );
-	return 1;
+	const char *star = nullptr, *resume = nullptr;
+	while( *name != '\0' )
+	{
+		if( *pattern == '*' )
+		{
+			star = pattern++;
+			resume = name;
+		}
+		else if( *pattern != '\0' &&
+			( *pattern == '?' || ToLower( static_cast<uint8_t>( *pattern ) ) == ToLower( static_cast<uint8_t>( *name ) ) ) )
+		{
+			++pattern;
+			++name;
+		}
+		else if( star != nullptr )
+		{
+			pattern = star + 1;
+			name = ++resume;
+		}
+		else
+		{
+			return false;
+		}
+	}
+
+	while( *pattern == '*' )
+		++pattern;
+
+	return *pattern == '\0';
 }
 
-LUA_FUNCTION_STATIC( HasFlag )
+// Callers Verify first, so commands unregistered anywhere in the list are gone.
+inline bool Contains( ConCommand *command )
 {
-	LUA->Push( Get( LUA, 1 )->IsFlagSet( static_cast<int32_t>( LUA->CheckNumber( 2 ) ) ) );
-	return 1;
+	return ids.Find( command ) != nullptr;
 }
 
-LUA_FUNCTION_STATIC( SetHelpText )
+static void SetFlags( ConCommand *command, int32_t flags )
 {
-	Container *udata = GetUserdata( LUA, 1 );
-	ConCommand *command = udata->cmd;
-	if( command == nullptr )
-		LUA->ThrowError( invalid_error );
+	const uint32_t changed = static_cast<uint32_t>( command->m_nFlags ^ flags );
+	command->m_nFlags = flags;
 
-	V_strncpy( udata->help, LUA->CheckString( 2 ), sizeof( udata->help ) );
-	command->m_pszHelpString = udata->help;
+	const uint32_t *id = ids.Find( command );
+	if( id == nullptr || changed == 0 )
+		return;
 
-	return 0;
+	const uint32_t word = *id / 32, bitmask = 1u << ( *id % 32 );
+	for( size_t bit = 0; bit < 32; ++bit )
+		if( ( changed & ( 1u << bit ) ) != 0 )
+			flag_bits[bit][word] ^= bitmask;
 }
 
-LUA_FUNCTION_STATIC( GetHelpText )
+enum class Match
 {
-	LUA->PushString( Get( LUA, 1 )->GetHelpText( ) );
-	return 1;
+	All,
+	Any,
+	None
+};
+
+// Fills result with the bitset of command IDs matching the mask, a word at a time.
+static void MatchFlags( int32_t flags, Match match, std::vector<uint32_t> &result )
+{
+	Verify( );
+
+	const uint32_t mask = static_cast<uint32_t>( flags );
+	result = live_bits;
+	if( mask == 0 )
+	{
+		if( match == Match::Any )
+			result.assign( result.size( ), 0 );
+
+		return;
+	}
+
+	if( match == Match::All )
+	{
+		for( size_t bit = 0; bit < 32; ++bit )
+			if( ( mask & ( 1u << bit ) ) != 0 )
+				for( size_t w = 0; w < result.size( ); ++w )
+					result[w] &= flag_bits[bit][w];
+
+		return;
+	}
+
+	std::vector<uint32_t> any( result.size( ), 0 );
+	for( size_t bit = 0; bit < 32; ++bit )
+		if( ( mask & ( 1u << bit ) ) != 0 )
+			for( size_t w = 0; w < any.size( ); ++w )
+				any[w] |= flag_bits[bit][w];
+
+	for( size_t w = 0; w < result.size( ); ++w )
+		result[w] &= match == Match::Any ? any[w] : ~any[w];
 }
 
-LUA_FUNCTION_STATIC( Remove )
+inline uint32_t PopCount( uint32_t word )
 {
-	CheckType( LUA, 1 );
-	global::icvar->UnregisterConCommand( Destroy( LUA, 1 ) );
-	return 0;
+	word = word - ( ( word >> 1 ) & 0x55555555u );
+	word = ( word & 0x33333333u ) + ( ( word >> 2 ) & 0x33333333u );
+	return ( ( ( word + ( word >> 4 ) ) & 0x0F0F0F0Fu ) * 0x01010101u ) >> 24;
 }
 
-static void Initialize( GarrysMod::Lua::ILuaBase *LUA )
+inline uint32_t LowestBit( uint32_t word )
 {
-	LUA->CreateTable( );
-	LUA->SetField( GarrysMod::Lua::INDEX_REGISTRY, table_name );
+#if defined _MSC_VER
 
-	metatype = LUA->CreateMetaTable( metaname );
+	unsigned long index = 0;
+	_BitScanForward( &index, word );
+	return index;
 
-	LUA->PushCFunction( gc );
-	LUA->SetField( -2, "__gc" );
+#else
 
-	LUA->PushCFunction( tostring );
-	LUA->SetField( -2, "__tostring" );
+	return static_cast<uint32_t>( __builtin_ctz( word ) );
 
-	LUA->PushCFunction( eq );
-	LUA->SetField( -2, "__eq" );
+#endif
+}
 
-	LUA->PushCFunction( index );
-	LUA->SetField( -2, "__index" );
+static void Deinitialize( )
+{
+	names.Clear( );
+	std::vector<ConCommand *>( ).swap( commands );
+	std::vector<ConCommand *>( ).swap( sorted );
+	ids.Clear( );
+	std::vector<uint32_t>( ).swap( live_bits );
+	for( size_t bit = 0; bit < 32; ++bit )
+		std::vector<uint32_t>( ).swap( flag_bits[bit] );
+
+	head = nullptr;
+	signature = 0;
+	dirty = true;
+}
 
-	LUA->PushCFunction( newindex );
-	LUA->SetField( -2, "__newindex" );
+}
 
-	LUA->PushCFunction( GetName );
-	LUA->SetField( -2, "GetName" );
+namespace search
+{
+
+// Trigram index over command names and help texts (including the ones
+// overridden through concommand:SetHelpText), rebuilt whenever the registry
+// generation changes or this module edits a name or help text.
+
+static TrigramIndex index;
+static std::vector<ConCommand *> documents;
+static uint32_t generation = 0;
+static bool dirty = true;
+
+inline void Invalidate( )
+{
+	dirty = true;
+}
+
+static void Rebuild( )
+{
+	index.Clear( );
+	documents = registry::commands;
+	for( size_t id = 0; id < documents.size( ); ++id )
+		index.Add( documents[id]->m_pszName, documents[id]->m_pszHelpString );
+
+	generation = registry::generation;
+	dirty = false;
+}
+
+struct Match
+{
+	ConCommand *cmd;
+	uint32_t matched;
+	uint32_t name_matched;
+};
+
+inline bool MatchBetter( const Match &a, const Match &b )
+{
+	if( a.matched != b.matched )
+		return a.matched > b.matched;
+
+	if( a.name_matched != b.name_matched )
+		return a.name_matched > b.name_matched;
+
+	return registry::CompareNames( a.cmd->m_pszName, b.cmd->m_pszName ) < 0;
+}
+
+// Ranks commands by how many distinct query trigrams they contain, then by how
+// many of those are in the name.
+static void Query( const char *query, std::vector<Match> &matches )
+{
+	std::vector<TrigramIndex::Match> found;
+	index.Query( query, found );
+
+	matches.resize( found.size( ) );
+	for( size_t k = 0; k < found.size( ); ++k )
+	{
+		Match match = { documents[found[k].id], found[k].matched, found[k].name_matched };
+		matches[k] = match;
+	}
+}
+
+static void Search( const char *query, size_t limit, std::vector<Match> &matches )
+{
+	registry::Validate( );
+
+	for( bool retried = false; ; retried = true )
+	{
+		if( dirty || generation != registry::generation )
+			Rebuild( );
+
+		Query( query, matches );
+
+		bool stale = false;
+		for( size_t k = 0; k < matches.size( ) && !stale; ++k )
+			stale = !matches[k].cmd->m_bRegistered;
+
+		if( !stale || retried )
+			break;
+
+		registry::Rebuild( );
+	}
+
+	if( limit != 0 && limit < matches.size( ) )
+	{
+		std::partial_sort( matches.begin( ), matches.begin( ) + limit, matches.end( ), MatchBetter );
+		matches.resize( limit );
+	}
+	else
+	{
+		std::sort( matches.begin( ), matches.end( ), MatchBetter );
+	}
+}
+
+static void Deinitialize( )
+{
+	index.Clear( );
+	std::vector<ConCommand *>( ).swap( documents );
+	dirty = true;
+}
+
+}
+
+namespace arguments
+{
+
+// Read-only view over a CCommand for native Lua handlers. A single userdata is
+// shared by every dispatch and only points at the CCommand for as long as the
+// handler runs, so arguments are read straight from m_ppArgv/m_pArgSBuffer
+// and nothing is allocated unless the handler asks for a table.
+
+struct Container
+{
+	const CCommand *args;
+};
+
+static const char *metaname = "concommand_arguments";
+static int32_t metatype = -1;
+static const char *invalid_error = "arguments are only valid while their command runs";
+static int32_t reference = -1;
+static Container *view = nullptr;
+
+static const CCommand *Get( GarrysMod::Lua::ILuaBase *LUA, int32_t index )
+{
+	if( !LUA->IsType( index, metatype ) )
+		LUA->TypeError( index, metaname );
+
+	const CCommand *args = LUA->GetUserType<Container>( index, metatype )->args;
+	if( args == nullptr )
+		LUA->ArgError( index, invalid_error );
+
+	return args;
+}
+
+// Points the shared view at the arguments and pushes it. Returns what it
+// pointed to before, to be handed back to Release once the handler returns.
+inline const CCommand *Bind( GarrysMod::Lua::ILuaBase *LUA, const CCommand &args )
+{
+	const CCommand *previous = view->args;
+	view->args = &args;
+	LUA->ReferencePush( reference );
+	return previous;
+}
+
+inline void Release( const CCommand *previous )
+{
+	view->args = previous;
+}
+
+LUA_FUNCTION_STATIC( tostring )
+{
+	LUA->PushFormattedString( "%s: %p", metaname, Get( LUA, 1 ) );
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( ArgC )
+{
+	LUA->PushNumber( Get( LUA, 1 )->ArgC( ) );
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( Arg )
+{
+	const CCommand *args = Get( LUA, 1 );
+	LUA->PushString( args->Arg( static_cast<int32_t>( LUA->CheckNumber( 2 ) ) ) );
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( ArgS )
+{
+	LUA->PushString( Get( LUA, 1 )->ArgS( ) );
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( GetCommandString )
+{
+	LUA->PushString( Get( LUA, 1 )->GetCommandString( ) );
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( ArgInt )
+{
+	const CCommand *args = Get( LUA, 1 );
+	const char *arg = args->Arg( static_cast<int32_t>( LUA->CheckNumber( 2 ) ) );
+
+	char *end = nullptr;
+	const long value = std::strtol( arg, &end, 10 );
+	if( end == arg )
+		LUA->PushNumber( LUA->IsType( 3, GarrysMod::Lua::Type::NUMBER ) ? LUA->GetNumber( 3 ) : 0 );
+	else
+		LUA->PushNumber( value );
+
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( ArgFloat )
+{
+	const CCommand *args = Get( LUA, 1 );
+	const char *arg = args->Arg( static_cast<int32_t>( LUA->CheckNumber( 2 ) ) );
+
+	char *end = nullptr;
+	const double value = std::strtod( arg, &end );
+	if( end == arg )
+		LUA->PushNumber( LUA->IsType( 3, GarrysMod::Lua::Type::NUMBER ) ? LUA->GetNumber( 3 ) : 0 );
+	else
+		LUA->PushNumber( value );
+
+	return 1;
+}
+
+// Arguments after the command name, like the table concommand.Add callbacks get.
+LUA_FUNCTION_STATIC( ToTable )
+{
+	const CCommand *args = Get( LUA, 1 );
+
+	LUA->CreateTable( );
+	for( int32_t i = 1; i < args->ArgC( ); ++i )
+	{
+		LUA->PushNumber( i );
+		LUA->PushString( args->Arg( i ) );
+		LUA->SetTable( -3 );
+	}
+
+	return 1;
+}
+
+static void Initialize( GarrysMod::Lua::ILuaBase *LUA )
+{
+	metatype = LUA->CreateMetaTable( metaname );
+
+	LUA->Push( -1 );
+	LUA->SetField( -2, "__index" );
+
+	LUA->PushCFunction( tostring );
+	LUA->SetField( -2, "__tostring" );
+
+	LUA->PushCFunction( ArgC );
+	LUA->SetField( -2, "ArgC" );
+
+	LUA->PushCFunction( Arg );
+	LUA->SetField( -2, "Arg" );
+
+	LUA->PushCFunction( ArgS );
+	LUA->SetField( -2, "ArgS" );
+
+	LUA->PushCFunction( GetCommandString );
+	LUA->SetField( -2, "GetCommandString" );
+
+	LUA->PushCFunction( ArgInt );
+	LUA->SetField( -2, "ArgInt" );
+
+	LUA->PushCFunction( ArgFloat );
+	LUA->SetField( -2, "ArgFloat" );
+
+	LUA->PushCFunction( ToTable );
+	LUA->SetField( -2, "ToTable" );
+
+	LUA->Pop( 1 );
+
+	view = LUA->NewUserType<Container>( metatype );
+	view->args = nullptr;
+
+	LUA->PushMetaTable( metatype );
+	LUA->SetMetaTable( -2 );
+
+	reference = LUA->ReferenceCreate( );
+}
+
+static void Deinitialize( GarrysMod::Lua::ILuaBase *LUA )
+{
+	if( reference != -1 )
+	{
+		LUA->ReferenceFree( reference );
+		reference = -1;
+	}
+
+	view = nullptr;
+
+	LUA->PushNil( );
+	LUA->SetField( GarrysMod::Lua::INDEX_REGISTRY, metaname );
+}
+
+}
+
+namespace handlers
+{
+
+// ConCommands registered by this module, whose callback calls a Lua function
+// kept in a registry reference, with the shared arguments view as argument.
+class Handler : public ConCommand, public ICommandCallback
+{
+public:
+	Handler( const std::string &name, const std::string &help, int32_t flags, int32_t function ) :
+		ConCommand( name.c_str( ), this, help.c_str( ), flags | FCVAR_UNREGISTERED ),
+		name( name ),
+		help( help ),
+		function( function )
+	{
+		// FCVAR_UNREGISTERED kept the base constructor from queueing us for
+		// ConVar_Register, we register with ICvar directly
+		m_pszName = this->name.c_str( );
+		m_pszHelpString = this->help.c_str( );
+		m_nFlags = flags;
+	}
+
+	virtual void CommandCallback( const CCommand &args )
+	{
+		GarrysMod::Lua::ILuaBase *LUA = global::lua;
+
+		LUA->ReferencePush( function );
+		const CCommand *previous = arguments::Bind( LUA, args );
+
+		++depth;
+		if( LUA->PCall( 1, 0, 0 ) != 0 )
+		{
+			const char *error = LUA->GetString( -1 );
+			Warning( "[concommandx] %s\n", error != nullptr ? error : "unknown error" );
+			LUA->Pop( 1 );
+		}
+		--depth;
+
+		arguments::Release( previous );
+
+		// handlers removed while callbacks ran, maybe this one, can go now
+		if( depth == 0 )
+			Collect( LUA );
+	}
+
+	static void Collect( GarrysMod::Lua::ILuaBase *LUA );
+
+	std::string name;
+	std::string help;
+	int32_t function;
+
+	// callbacks running right now, handlers can't be deleted under them
+	static uint32_t depth;
+};
+
+uint32_t Handler::depth = 0;
+
+static PointerMap<Handler *> handlers;
+static std::vector<Handler *> removed;
+
+void Handler::Collect( GarrysMod::Lua::ILuaBase *LUA )
+{
+	if( depth != 0 || removed.empty( ) )
+		return;
+
+	std::vector<Handler *> collecting;
+	collecting.swap( removed );
+	for( size_t k = 0; k < collecting.size( ); ++k )
+	{
+		LUA->ReferenceFree( collecting[k]->function );
+		delete collecting[k];
+	}
+}
+
+inline void Collect( GarrysMod::Lua::ILuaBase *LUA )
+{
+	Handler::Collect( LUA );
+}
+
+static Handler *Create(
+	GarrysMod::Lua::ILuaBase *LUA,
+	const char *name,
+	const char *help,
+	int32_t flags,
+	int32_t index
+)
+{
+	Collect( LUA );
+
+	LUA->Push( index );
+	Handler *handler = new Handler( name, help, flags, LUA->ReferenceCreate( ) );
+	handlers.Insert( static_cast<ConCommand *>( handler ), handler );
+
+	global::icvar->RegisterConCommand( handler );
+	return handler;
+}
+
+// Called after the command was unregistered, deletes it if it's one of ours.
+static void Destroy( GarrysMod::Lua::ILuaBase *LUA, ConCommand *command )
+{
+	Handler **handler = handlers.Find( command );
+	if( handler == nullptr )
+		return;
+
+	removed.push_back( *handler );
+	handlers.Erase( command );
+	Collect( LUA );
+}
+
+static void Deinitialize( GarrysMod::Lua::ILuaBase *LUA )
+{
+	handlers.ForEach( []( const void *, Handler *handler )
+	{
+		global::icvar->UnregisterConCommand( handler );
+		removed.push_back( handler );
+	} );
+	handlers.Clear( );
+
+	Handler::depth = 0;
+	Collect( LUA );
+}
+
+}
+
+#if defined CONCOMMANDX_SERVER
+
+namespace ratelimit
+{
+
+// Token buckets for commands sent by clients. A rule applies to a command by
+// name or, when no name rule matches, by any of its flags. Each rate limited
+// command gets a column of a fixed pool of buckets indexed by player slot, so
+// commands covered by the same flag rule are limited separately. Commands
+// that find the pool full share a bucket per rule instead.
+
+static const size_t max_players = 128;
+static const size_t max_rules = 64;
+static const size_t max_columns = 512;
+static const uint32_t no_rule = ~0u;
+static const uint32_t no_column = ~0u;
+
+struct Rule
+{
+	std::string name;
+	int32_t flags;
+	double rate;
+	double burst;
+	uint64_t dropped;
+};
+
+struct Bucket
+{
+	double tokens;
+	double last;
+	uint32_t generation;
+};
+
+static std::vector<Rule> rules;
+static Bucket buckets[max_players][max_columns];
+static Bucket shared[max_players][max_rules];
+static std::vector<uint32_t> free_columns;
+static uint32_t columns_used = 0;
+// bumped whenever the rules change, buckets of older generations start full
+static uint32_t generation = 1;
+// player slot of the client whose command is being dispatched, -1 for the server
+static int32_t client = -1;
+
+inline bool Active( )
+{
+	return !rules.empty( );
+}
+
+inline double Now( )
+{
+	return std::chrono::duration<double>(
+		std::chrono::steady_clock::now( ).time_since_epoch( )
+	).count( );
+}
+
+static uint32_t Resolve( ConCommand *command )
+{
+	for( size_t k = 0; k < rules.size( ); ++k )
+		if( !rules[k].name.empty( ) && V_stricmp( rules[k].name.c_str( ), command->GetName( ) ) == 0 )
+			return static_cast<uint32_t>( k );
+
+	for( size_t k = 0; k < rules.size( ); ++k )
+		if( rules[k].name.empty( ) && ( rules[k].flags & command->m_nFlags ) != 0 )
+			return static_cast<uint32_t>( k );
+
+	return no_rule;
+}
+
+// Returns a column for a command that got a rule, no_column if the pool is full.
+static uint32_t Acquire( )
+{
+	uint32_t column = no_column;
+	if( !free_columns.empty( ) )
+	{
+		column = free_columns.back( );
+		free_columns.pop_back( );
+	}
+	else if( columns_used < max_columns )
+	{
+		column = columns_used++;
+	}
+	else
+	{
+		return no_column;
+	}
+
+	// whatever the previous command left there doesn't apply to this one
+	for( size_t k = 0; k < max_players; ++k )
+		buckets[k][column].generation = 0;
+
+	return column;
+}
+
+inline void Release( uint32_t column )
+{
+	if( column != no_column )
+		free_columns.push_back( column );
+}
+
+static bool Allow( uint32_t rule, uint32_t column )
+{
+	if( rule == no_rule || client < 0 || static_cast<size_t>( client ) >= max_players )
+		return true;
+
+	Rule &limit = rules[rule];
+	Bucket &bucket = column != no_column ? buckets[client][column] : shared[client][rule];
+	const double now = Now( );
+	if( bucket.generation != generation )
+	{
+		bucket.tokens = limit.burst;
+		bucket.generation = generation;
+	}
+	else
+	{
+		bucket.tokens = std::min( limit.burst, bucket.tokens + ( now - bucket.last ) * limit.rate );
+	}
+
+	bucket.last = now;
+	if( bucket.tokens < 1.0 )
+	{
+		++limit.dropped;
+		return false;
+	}
+
+	bucket.tokens -= 1.0;
+	return true;
+}
+
+static void Reset( int32_t slot )
+{
+	if( slot < 0 || static_cast<size_t>( slot ) >= max_players )
+		return;
+
+	for( size_t k = 0; k < max_columns; ++k )
+		buckets[slot][k].generation = 0;
+
+	for( size_t k = 0; k < max_rules; ++k )
+		shared[slot][k].generation = 0;
+}
+
+// Rule names are kept lowercase, commands match them case-insensitively like
+// the engine finds them.
+inline std::string Lower( const std::string &name )
+{
+	std::string lower( name );
+	for( size_t k = 0; k < lower.size( ); ++k )
+		lower[k] = static_cast<char>( registry::ToLower( static_cast<uint8_t>( lower[k] ) ) );
+
+	return lower;
+}
+
+static bool Exists( const std::string &name, int32_t flags )
+{
+	const std::string lower = Lower( name );
+	for( size_t k = 0; k < rules.size( ); ++k )
+		if( rules[k].name == lower && rules[k].flags == flags )
+			return true;
+
+	return false;
+}
+
+static void Set( const std::string &target, int32_t flags, double rate, double burst )
+{
+	const std::string name = Lower( target );
+	for( size_t k = 0; k < rules.size( ); ++k )
+		if( rules[k].name == name && rules[k].flags == flags )
+		{
+			if( rate < 0.0 )
+				rules.erase( rules.begin( ) + k );
+			else
+			{
+				rules[k].rate = rate;
+				rules[k].burst = burst;
+			}
+
+			++generation;
+			return;
+		}
+
+	if( rate < 0.0 )
+		return;
+
+	Rule rule = { name, flags, rate, burst, 0 };
+	rules.push_back( rule );
+	++generation;
+}
+
+static void Deinitialize( )
+{
+	rules.clear( );
+	++generation;
+	client = -1;
+}
+
+}
+
+#endif
+
+#if defined CONCOMMANDX_SERVER
+
+namespace policy
+{
+
+// Allow and deny rules for commands sent by clients, where patterns are
+// case-insensitive globs and the first rule that matches a name decides.
+
+static const uint32_t no_rule = GlobAutomaton::no_match;
+static const size_t max_states = 16384;
+
+struct Rule
+{
+	std::string pattern;
+	bool allow;
+	uint64_t hits;
+};
+
+static std::vector<Rule> rules;
+static bool default_allow = true;
+static uint64_t default_hits = 0;
+static GlobAutomaton automaton( max_states );
+// bumped whenever the rules change, so interceptors decide again
+static uint32_t generation = 1;
+
+inline bool Active( )
+{
+	return !rules.empty( );
+}
+
+// Returns the first rule matching the name, or no_rule.
+inline uint32_t Match( const char *name )
+{
+	return automaton.Match( name );
+}
+
+inline bool Decide( uint32_t rule )
+{
+	if( rule == no_rule )
+	{
+		++default_hits;
+		return default_allow;
+	}
+
+	++rules[rule].hits;
+	return rules[rule].allow;
+}
+
+static bool Set( std::vector<Rule> &compiling, bool allow, std::string &error )
+{
+	std::vector<std::string> patterns;
+	for( size_t k = 0; k < compiling.size( ); ++k )
+		patterns.push_back( compiling[k].pattern );
+
+	if( !automaton.Compile( patterns ) )
+	{
+		error = "policy is too complex";
+		return false;
+	}
+
+	rules.swap( compiling );
+	default_allow = allow;
+	default_hits = 0;
+	++generation;
+	return true;
+}
+
+static void Deinitialize( )
+{
+	std::vector<Rule> empty;
+	std::string error;
+	Set( empty, true, error );
+}
+
+}
+
+#endif
+
+namespace interceptors
+{
+
+// Dispatch interception: a command's callback (the m_fnCommandCallback /
+// m_pCommandCallback union) is swapped for an Interceptor, which calls the
+// original from its own CommandCallback. Commands that override Dispatch
+// itself can't be intercepted this way.
+// Interceptors are attached to every registered command while a feature
+// needs them, and to new commands as the ICvar hooks see them registered (or
+// on Sync, when the hooks aren't available).
+// On a listen server both modules intercept, so one's interceptor may be the
+// original callback of the other's. Whichever goes away first hands what it
+// had saved to the interceptor that wrapped it, through the ICvar hooks
+// broker, instead of restoring it over that interceptor.
+
+typedef std::chrono::steady_clock Clock;
+
+static const size_t histogram_buckets = 32;
+
+static bool profiling = false;
+
+// A command's callback as ConCommand keeps it, shared with the other module
+// through the broker.
+struct Callback
+{
+	FnCommandCallbackV1_t callback_v1;
+	FnCommandCallback_t callback;
+	ICommandCallback *callback_interface;
+	bool using_new_callback;
+	bool using_callback_interface;
+};
+
+class Interceptor;
+
+// Hands the callback an interceptor saved to the other module's interceptor
+// that wrapped it, returns whether there was one.
+static bool Unwrap( const Interceptor *interceptor );
+
+class Interceptor : public ICommandCallback
+{
+public:
+	explicit Interceptor( ConCommand *command ) :
+		command( command )
+	{
+		original.callback_v1 = command->m_fnCommandCallbackV1;
+		original.callback = command->m_fnCommandCallback;
+		original.callback_interface = command->m_pCommandCallback;
+		original.using_new_callback = command->m_bUsingNewCommandCallback;
+		original.using_callback_interface = command->m_bUsingCommandCallbackInterface;
+
+		Reset( );
+
+#if defined CONCOMMANDX_SERVER
+
+		rule = ratelimit::no_rule;
+		rule_column = ratelimit::no_column;
+		rule_generation = 0;
+		rule_name = nullptr;
+		rule_flags = 0;
+		rule_released = 0;
+		policy_rule = policy::no_rule;
+		policy_generation = 0;
+		policy_name = nullptr;
+		policy_released = 0;
+
+#endif
+
+		command->m_pCommandCallback = this;
+		command->m_bUsingNewCommandCallback = false;
+		command->m_bUsingCommandCallbackInterface = true;
+	}
+
+	virtual ~Interceptor( )
+	{
+
+#if defined CONCOMMANDX_SERVER
+
+		ratelimit::Release( rule_column );
+
+#endif
+
+	}
+
+	// Puts the original callback back, unless something wrapped this
+	// interceptor since. Returns false when that isn't the other module's
+	// interceptor, it still calls this one, which then has to be kept.
+	bool Restore( )
+	{
+		if( !command->m_bUsingCommandCallbackInterface || command->m_pCommandCallback != this )
+			return Unwrap( this );
+
+		command->m_fnCommandCallbackV1 = original.callback_v1;
+		if( original.using_new_callback )
+			command->m_fnCommandCallback = original.callback;
+		else if( original.using_callback_interface )
+			command->m_pCommandCallback = original.callback_interface;
+
+		command->m_bUsingNewCommandCallback = original.using_new_callback;
+		command->m_bUsingCommandCallbackInterface = original.using_callback_interface;
+		return true;
+	}
+
+	void Reset( )
+	{
+		calls = 0;
+		total = 0;
+		max = 0;
+		for( size_t k = 0; k < histogram_buckets; ++k )
+			histogram[k] = 0;
+	}
+
+	void CallOriginal( const CCommand &args )
+	{
+		if( original.using_new_callback )
+		{
+			if( original.callback != nullptr )
+				original.callback( args );
+		}
+		else if( original.using_callback_interface )
+		{
+			if( original.callback_interface != nullptr )
+				original.callback_interface->CommandCallback( args );
+		}
+		else if( original.callback_v1 != nullptr )
+		{
+			original.callback_v1( );
+		}
+	}
+
+	virtual void CommandCallback( const CCommand &args )
+	{
+
+#if defined CONCOMMANDX_SERVER
+
+		if( policy::Active( ) && ratelimit::client >= 0 )
+		{
+			if( policy_generation != policy::generation || policy_name != command->m_pszName ||
+				policy_released != strings::released )
+			{
+				policy_rule = policy::Match( command->GetName( ) );
+				policy_generation = policy::generation;
+				policy_name = command->m_pszName;
+				policy_released = strings::released;
+			}
+
+			if( !policy::Decide( policy_rule ) )
+				return;
+		}
+
+		if( ratelimit::Active( ) )
+		{
+			if( rule_generation != ratelimit::generation || rule_name != command->m_pszName ||
+				rule_flags != command->m_nFlags || rule_released != strings::released )
+			{
+				rule = ratelimit::Resolve( command );
+				rule_generation = ratelimit::generation;
+				rule_name = command->m_pszName;
+				rule_flags = command->m_nFlags;
+				rule_released = strings::released;
+
+				if( rule == ratelimit::no_rule )
+				{
+					ratelimit::Release( rule_column );
+					rule_column = ratelimit::no_column;
+				}
+				else if( rule_column == ratelimit::no_column )
+				{
+					rule_column = ratelimit::Acquire( );
+				}
+			}
+
+			if( !ratelimit::Allow( rule, rule_column ) )
+				return;
+		}
+
+#endif
+
+		++depth;
+
+		if( !profiling )
+		{
+			CallOriginal( args );
+			--depth;
+
+			// interceptors removed while callbacks ran, maybe this one, can go
+			if( depth == 0 )
+				Collect( );
+
+			return;
+		}
+
+		const Clock::time_point start = Clock::now( );
+		CallOriginal( args );
+		const uint64_t elapsed = static_cast<uint64_t>(
+			std::chrono::duration_cast<std::chrono::nanoseconds>( Clock::now( ) - start ).count( )
+		);
+
+		++calls;
+		total += elapsed;
+		if( elapsed > max )
+			max = elapsed;
+
+		// bucket k counts calls that took [2^k, 2^(k + 1)) nanoseconds
+		size_t bucket = 0;
+		for( uint64_t value = elapsed >> 1; value != 0 && bucket < histogram_buckets - 1; value >>= 1 )
+			++bucket;
+
+		++histogram[bucket];
+
+		--depth;
+		if( depth == 0 )
+			Collect( );
+	}
+
+	static void Collect( );
+
+	ConCommand *command;
+	Callback original;
+
+	uint64_t calls;
+	uint64_t total;
+	uint64_t max;
+	uint64_t histogram[histogram_buckets];
+
+#if defined CONCOMMANDX_SERVER
+
+	// rate limiting rule, resolved again when the rules, name or flags change
+	// (names are compared by pointer, so also when an interned string was
+	// freed), and the bucket column of this command while it has one
+	uint32_t rule;
+	uint32_t rule_column;
+	uint32_t rule_generation;
+	const char *rule_name;
+	int32_t rule_flags;
+	uint32_t rule_released;
+
+	// policy rule matching the name, matched again when the rules or name
+	// change, or an interned string was freed
+	uint32_t policy_rule;
+	uint32_t policy_generation;
+	const char *policy_name;
+	uint32_t policy_released;
+
+#endif
+
+	// callbacks running right now, interceptors can't be deleted under them
+	static uint32_t depth;
+};
+
+uint32_t Interceptor::depth = 0;
+
+static PointerMap<Interceptor *> interceptors;
+static std::vector<Interceptor *> removed;
+// interceptors of commands unregistered behind our back, which may not exist
+// anymore, and interceptors something else still calls, so they are neither
+// restored nor deleted until the module closes
+static std::vector<Interceptor *> orphans;
+
+// registry generation the interceptors were last attached at
+static uint32_t synced_generation = 0;
+
+inline bool Wanted( )
+{
+
+#if defined CONCOMMANDX_SERVER
+
+	if( ratelimit::Active( ) || policy::Active( ) )
+		return true;
+
+#endif
+
+	return profiling;
+}
+
+void Interceptor::Collect( )
+{
+	if( depth != 0 || removed.empty( ) )
+		return;
+
+	std::vector<Interceptor *> collecting;
+	collecting.swap( removed );
+	for( size_t k = 0; k < collecting.size( ); ++k )
+		delete collecting[k];
+}
+
+inline void Collect( )
+{
+	Interceptor::Collect( );
+}
+
+// Takes an interceptor off its command, to be deleted once no callback runs.
+static void Remove( Interceptor *interceptor )
+{
+	if( interceptor->Restore( ) )
+		removed.push_back( interceptor );
+	else
+		orphans.push_back( interceptor );
+}
+
+// Restores the callback of a command about to be unregistered.
+static void Detach( ConCommand *command )
+{
+	Interceptor **interceptor = interceptors.Find( command );
+	if( interceptor == nullptr )
+		return;
+
+	Remove( *interceptor );
+	interceptors.Erase( command );
+	Collect( );
+}
+
+// The other module's interceptor is going away, ours calls what it called
+// from now on if it was the one calling it.
+static bool Adopt( ConCommand *command, const ICommandCallback *callback, const Callback &saved )
+{
+	Interceptor **interceptor = interceptors.Find( command );
+	if( interceptor == nullptr || !( *interceptor )->original.using_callback_interface ||
+		( *interceptor )->original.callback_interface != callback )
+		return false;
+
+	( *interceptor )->original = saved;
+	return true;
+}
+
+static void Attach( )
+{
+	synced_generation = registry::generation;
+
+	std::vector<ConCommand *> gone;
+	interceptors.ForEach( [&gone]( const void *key, Interceptor * )
+	{
+		ConCommand *command = static_cast<ConCommand *>( const_cast<void *>( key ) );
+		if( !registry::Contains( command ) )
+			gone.push_back( command );
+	} );
+
+	for( size_t k = 0; k < gone.size( ); ++k )
+	{
+		orphans.push_back( *interceptors.Find( gone[k] ) );
+		interceptors.Erase( gone[k] );
+	}
+
+	if( !Wanted( ) )
+	{
+		interceptors.ForEach( []( const void *, Interceptor *interceptor )
+		{
+			Remove( interceptor );
+		} );
+		interceptors.Clear( );
+		Collect( );
+		return;
+	}
+
+	const std::vector<ConCommand *> &commands = registry::commands;
+	for( size_t k = 0; k < commands.size( ); ++k )
+		if( interceptors.Find( commands[k] ) == nullptr )
+			interceptors.Insert( commands[k], new Interceptor( commands[k] ) );
+}
+
+static void Sync( )
+{
+	registry::Verify( );
+	Attach( );
+}
+
+// Called by the RegisterConCommand hook for every new command.
+inline void Intercept( ConCommand *command )
+{
+	if( Wanted( ) && interceptors.Find( command ) == nullptr )
+		interceptors.Insert( command, new Interceptor( command ) );
+}
+
+// Cheap enough to run before every client command, picks up commands that
+// were registered since the last Sync.
+inline void Refresh( )
+{
+	if( !Wanted( ) )
+		return;
+
+	registry::Validate( );
+	if( registry::generation != synced_generation )
+		Attach( );
+}
+
+static void Deinitialize( )
+{
+	profiling = false;
+	Sync( );
+
+	Interceptor::depth = 0;
+	Collect( );
+
+	for( size_t k = 0; k < orphans.size( ); ++k )
+		delete orphans[k];
+
+	orphans.clear( );
+}
+
+}
+
+#if defined CONCOMMANDX_SERVER
+
+namespace clients
+{
+
+// The engine tells the game which client sent the command it's about to
+// dispatch through IServerGameClients::SetCommandClient (-1 for the server),
+// so both it and ClientDisconnect are hooked to feed the rate limiter.
+
+static SourceSDK::FactoryLoader server_loader( "server", false, IS_SERVERSIDE, "garrysmod/bin/" );
+static IServerGameClients *servergameclients = nullptr;
+
+class Proxy : public Detouring::ClassProxy<IServerGameClients, Proxy>
+{
+public:
+	void SetCommandClient( int index )
+	{
+		ratelimit::client = index;
+		interceptors::Refresh( );
+		Call( &IServerGameClients::SetCommandClient, index );
+	}
+
+	void ClientDisconnect( edict_t *edict )
+	{
+		// entity indices of players are their slots plus one
+		ratelimit::Reset( global::ivengine->IndexOfEdict( edict ) - 1 );
+		Call( &IServerGameClients::ClientDisconnect, edict );
+	}
+};
+
+static Proxy proxy;
+
+inline bool Available( )
+{
+	return servergameclients != nullptr;
+}
+
+static void Initialize( )
+{
+	IServerGameClients *gameclients =
+		server_loader.GetInterface<IServerGameClients>( INTERFACEVERSION_SERVERGAMECLIENTS );
+	if( gameclients == nullptr || !Proxy::Initialize( gameclients, &proxy ) )
+	{
+		Warning( "[concommandx] IServerGameClients not available, rate limiting is disabled\n" );
+		return;
+	}
+
+	Proxy::Hook( &IServerGameClients::SetCommandClient, &Proxy::SetCommandClient );
+	Proxy::Hook( &IServerGameClients::ClientDisconnect, &Proxy::ClientDisconnect );
+	servergameclients = gameclients;
+}
+
+static void Deinitialize( )
+{
+	if( servergameclients == nullptr )
+		return;
+
+	Proxy::UnHook( &IServerGameClients::SetCommandClient );
+	Proxy::UnHook( &IServerGameClients::ClientDisconnect );
+	servergameclients = nullptr;
+}
+
+}
+
+#endif
+
+namespace handles
+{
+
+// Lua objects refer to commands through handles, whose slot generation is
+// bumped when the command goes away, including when it's unregistered behind
+// our back, so a stale object resolves to nullptr.
+
+typedef HandleTable<ConCommand>::Handle Handle;
+
+static HandleTable<ConCommand> table;
+
+inline Handle Acquire( ConCommand *command )
+{
+	return table.Acquire( command );
+}
+
+inline ConCommand *Resolve( const Handle &handle )
+{
+	return table.Resolve( handle );
+}
+
+inline void Release( ConCommand *command )
+{
+	table.Release( command );
+}
+
+static void Deinitialize( )
+{
+	table.Clear( );
+}
+
+}
+
+namespace reordering
+{
+
+// Opt-in relinking of the engine's command list, which ICvar::FindCommandBase
+// scans linearly from its head. Lookups made on the main thread are counted
+// through ICvar hooks, installed only while reordering is enabled, and every
+// interval the list is relinked from the scheduler's Think hook with the most
+// looked up entries first. The head itself stays put, ICvar keeps its own
+// pointer to it. The engine finds every command it dispatches this way, so the
+// lookup counts include dispatches.
+// Relinking rewrites m_pNext in place, without any lock the engine would
+// honour. Nothing on the main thread walks the list during Think, but engine
+// threads that look up convars may, and they can miss or revisit entries
+// while it happens. So can walks spread over several ticks, such as
+// concommand.Iterate loops that yield in between.
+
+typedef std::chrono::steady_clock Clock;
+
+static bool enabled = false;
+static Clock::duration interval = std::chrono::seconds( 10 );
+static Clock::time_point next;
+static std::thread::id owner;
+static PointerMap<uint32_t> counts;
+
+static uint64_t lookups = 0;
+static uint64_t misses = 0;
+static uint64_t reorders = 0;
+// average position of a looked up entry, 1 being the head, before and after
+// the last relink
+static double depth_before = 0.0;
+static double depth_after = 0.0;
+
+inline bool Counting( )
+{
+	return enabled && std::this_thread::get_id( ) == owner;
+}
+
+inline void Count( const ConCommandBase *base )
+{
+	++lookups;
+	if( base == nullptr )
+	{
+		++misses;
+		return;
+	}
+
+	uint32_t *count = counts.Find( base );
+	if( count != nullptr )
+		++*count;
+	else
+		counts.Insert( base, 1 );
+}
+
+struct Ranked
+{
+	ConCommandBase *base;
+	uint32_t count;
+};
+
+inline bool Hotter( const Ranked &a, const Ranked &b )
+{
+	return a.count > b.count;
+}
+
+static void Relink( )
+{
+	ConCommandBase *head = global::icvar->GetCommands( );
+	if( head == nullptr || counts.Size( ) == 0 )
+		return;
+
+	std::vector<Ranked> ranked;
+	for( ConCommandBase *base = head->m_pNext; base != nullptr; base = base->m_pNext )
+	{
+		const uint32_t *count = counts.Find( base );
+		Ranked entry = { base, count != nullptr ? *count : 0 };
+		ranked.push_back( entry );
+	}
+
+	const uint32_t *head_count = counts.Find( head );
+	double hits = head_count != nullptr ? *head_count : 0.0, before = hits, after = hits;
+	for( size_t k = 0; k < ranked.size( ); ++k )
+	{
+		hits += ranked[k].count;
+		before += static_cast<double>( ranked[k].count ) * ( k + 2 );
+	}
+
+	if( ranked.empty( ) )
+		return;
+
+	std::stable_sort( ranked.begin( ), ranked.end( ), Hotter );
+
+	// Linked back to front, so a walker following old links ends up in an
+	// already relinked, terminated tail. It can't loop, but it can skip or
+	// repeat entries.
+	const size_t last = ranked.size( ) - 1;
+	ranked[last].base->m_pNext = nullptr;
+	after += static_cast<double>( ranked[last].count ) * ( last + 2 );
+	for( size_t k = last; k-- > 0; )
+	{
+		after += static_cast<double>( ranked[k].count ) * ( k + 2 );
+		ranked[k].base->m_pNext = ranked[k + 1].base;
+	}
+
+	head->m_pNext = ranked[0].base;
+
+	if( hits != 0.0 )
+	{
+		depth_before = before / hits;
+		depth_after = after / hits;
+	}
+
+	counts.Clear( );
+	++reorders;
+
+	registry::Invalidate( );
+	search::Invalidate( );
+}
+
+// Main thread only, relinks the list once the interval has passed.
+inline void Tick( )
+{
+	if( !enabled )
+		return;
+
+	const Clock::time_point now = Clock::now( );
+	if( now < next )
+		return;
+
+	next = now + interval;
+	Relink( );
+}
+
+static void Set( bool enable, double seconds )
+{
+	interval = std::chrono::duration_cast<Clock::duration>( std::chrono::duration<double>( seconds ) );
+	next = Clock::now( ) + interval;
+	owner = std::this_thread::get_id( );
+	enabled = enable;
+	if( !enable )
+		counts.Clear( );
+}
+
+static void Deinitialize( )
+{
+	enabled = false;
+	counts.Clear( );
+}
+
+}
+
+namespace cvarhooks
+{
+
+// ICvar is hooked so this module hears about commands being registered or
+// unregistered by anyone, most importantly by DLLs unloading, before their
+// memory goes away. Without the hooks the registry only notices later and
+// objects and interceptors of those commands are left dangling.
+// A listen server loads the server and the client module in the same process,
+// and hooking ICvar from both would chain the hooks. The first module to load
+// owns them and registers a hidden broker command, the other one finds it and
+// subscribes to it. If the owner unloads first, its subscribers take over.
+
+// Callbacks of one module, called from the owner's hooks.
+struct Listener
+{
+	void ( *registered )( ConCommandBase *base );
+	// before the command is unregistered, it's still valid
+	void ( *unregistering )( ConCommand *command );
+	void ( *unregistered )( ConCommand *command );
+	// after several commands were unregistered at once
+	void ( *invalidated )( );
+	void ( *looked_up )( const ConCommandBase *base );
+	// the owner unloaded, the subscriber has to install the hooks itself
+	void ( *orphaned )( );
+	// another module's interceptor is going away, returns whether it was the
+	// original callback of this module's interceptor, which then takes saved
+	bool ( *unwrapping )(
+		ConCommand *command,
+		const ICommandCallback *interceptor,
+		const interceptors::Callback &saved
+	);
+	// wants looked_up calls, the lookup hooks are only installed while one does
+	bool lookups;
+};
+
+static const char *broker_name = "concommandx_cvarhooks";
+// bumped whenever Listener or Broker change, modules only share equal ones
+static const uint32_t broker_version = 3;
+static const size_t max_listeners = 4;
+
+class Broker : public ConCommand, public ICommandCallback
+{
+public:
+	Broker( ) :
+		ConCommand( broker_name, this, "", FCVAR_UNREGISTERED ),
+		version( broker_version ),
+		update( nullptr )
+	{
+		m_nFlags = FCVAR_HIDDEN | FCVAR_DEVELOPMENTONLY;
+		for( size_t k = 0; k < max_listeners; ++k )
+			listeners[k] = nullptr;
+	}
+
+	virtual void CommandCallback( const CCommand & )
+	{ }
+
+	uint32_t version;
+	Listener *listeners[max_listeners];
+	// the owner's, (un)hooks the lookups after a lookups flag changed
+	void ( *update )( );
+};
+
+// the broker this module subscribed to, its own if it owns the hooks
+static Broker *broker = nullptr;
+static bool owner = false;
+static bool finding = false;
+static std::thread::id main_thread;
+
+class Proxy : public Detouring::ClassProxy<ICvar, Proxy>
+{
+public:
+	void RegisterConCommand( ConCommandBase *base )
+	{
+		Call( &ICvar::RegisterConCommand, base );
+		for( size_t k = 0; k < max_listeners; ++k )
+			if( broker->listeners[k] != nullptr )
+				broker->listeners[k]->registered( base );
+	}
+
+	void UnregisterConCommand( ConCommandBase *base )
+	{
+		if( !base->IsCommand( ) )
+		{
+			Call( &ICvar::UnregisterConCommand, base );
+			return;
+		}
+
+		ConCommand *command = static_cast<ConCommand *>( base );
+		for( size_t k = 0; k < max_listeners; ++k )
+			if( broker->listeners[k] != nullptr )
+				broker->listeners[k]->unregistering( command );
+
+		Call( &ICvar::UnregisterConCommand, base );
+		for( size_t k = 0; k < max_listeners; ++k )
+			if( broker->listeners[k] != nullptr )
+				broker->listeners[k]->unregistered( command );
+	}
+
+	ConCommandBase *FindCommandBase( const char *name )
+	{
+		if( depth != 0 || std::this_thread::get_id( ) != main_thread )
+			return Call( find_command_base, name );
+
+		++depth;
+		ConCommandBase *base = Call( find_command_base, name );
+		--depth;
+		LookedUp( base );
+		return base;
+	}
+
+	ConCommand *FindCommand( const char *name )
+	{
+		if( depth != 0 || std::this_thread::get_id( ) != main_thread )
+			return Call( find_command, name );
+
+		++depth;
+		ConCommand *command = Call( find_command, name );
+		--depth;
+		LookedUp( command );
+		return command;
+	}
+
+	void UnregisterConCommands( CVarDLLIdentifier_t id )
+	{
+		for( ConCommandBase *base = global::icvar->GetCommands( ); base != nullptr; base = base->m_pNext )
+			if( base->IsCommand( ) && base->GetDLLIdentifier( ) == id )
+				for( size_t k = 0; k < max_listeners; ++k )
+					if( broker->listeners[k] != nullptr )
+						broker->listeners[k]->unregistering( static_cast<ConCommand *>( base ) );
+
+		Call( &ICvar::UnregisterConCommands, id );
+		for( size_t k = 0; k < max_listeners; ++k )
+			if( broker->listeners[k] != nullptr )
+				broker->listeners[k]->invalidated( );
+	}
+
+	// the non-const overloads, ICvar has const versions of both too
+	static ConCommandBase *( ICvar::*find_command_base )( const char * );
+	static ConCommand *( ICvar::*find_command )( const char * );
+
+private:
+	static void LookedUp( const ConCommandBase *base )
+	{
+		for( size_t k = 0; k < max_listeners; ++k )
+			if( broker->listeners[k] != nullptr )
+				broker->listeners[k]->looked_up( base );
+	}
+
+	// lookups in progress, FindCommand may go through FindCommandBase itself
+	static uint32_t depth;
+};
+
+ConCommandBase *( ICvar::*Proxy::find_command_base )( const char * ) = &ICvar::FindCommandBase;
+ConCommand *( ICvar::*Proxy::find_command )( const char * ) = &ICvar::FindCommand;
+uint32_t Proxy::depth = 0;
+
+static Proxy proxy;
+
+static void Registered( ConCommandBase *base )
+{
+	registry::Invalidate( );
+	search::Invalidate( );
+	if( base->IsCommand( ) )
+		interceptors::Intercept( static_cast<ConCommand *>( base ) );
+}
+
+static void Unregistering( ConCommand *command )
+{
+	interceptors::Detach( command );
+	handles::Release( command );
+	search::Invalidate( );
+}
+
+static void Unregistered( ConCommand *command )
+{
+	registry::Remove( command );
+}
+
+static void Invalidated( )
+{
+	registry::Invalidate( );
+}
+
+static void LookedUp( const ConCommandBase *base )
+{
+	if( reordering::Counting( ) )
+		reordering::Count( base );
+}
+
+static void Orphaned( );
+
+static bool Unwrapping(
+	ConCommand *command,
+	const ICommandCallback *interceptor,
+	const interceptors::Callback &saved
+)
+{
+	return interceptors::Adopt( command, interceptor, saved );
+}
+
+static Listener listener = {
+	Registered,
+	Unregistering,
+	Unregistered,
+	Invalidated,
+	LookedUp,
+	Orphaned,
+	Unwrapping,
+	false
+};
+
+inline bool Available( )
+{
+	return broker != nullptr;
+}
+
+// Owner only, lookups are hooked while any module wants them, they are on
+// the path of every command the engine dispatches.
+static void Update( )
+{
+	bool wanted = false;
+	for( size_t k = 0; k < max_listeners; ++k )
+		if( broker->listeners[k] != nullptr && broker->listeners[k]->lookups )
+			wanted = true;
+
+	if( wanted == finding )
+		return;
+
+	if( wanted )
+	{
+		Proxy::Hook( Proxy::find_command_base, &Proxy::FindCommandBase );
+		Proxy::Hook( Proxy::find_command, &Proxy::FindCommand );
+	}
+	else
+	{
+		Proxy::UnHook( Proxy::find_command_base );
+		Proxy::UnHook( Proxy::find_command );
+	}
+
+	finding = wanted;
+}
+
+static void SetLookups( bool enable )
+{
+	listener.lookups = enable;
+	if( broker != nullptr )
+		broker->update( );
+}
+
+static void Subscribe( Broker *existing )
+{
+	if( existing->version != broker_version )
+	{
+		Warning( "[concommandx] another version of this module hooked ICvar, unregistered commands may be left dangling\n" );
+		return;
+	}
+
+	for( size_t k = 0; k < max_listeners; ++k )
+		if( existing->listeners[k] == nullptr )
+		{
+			existing->listeners[k] = &listener;
+			broker = existing;
+			broker->update( );
+			registry::Track( true );
+			return;
+		}
+
+	Warning( "[concommandx] too many modules subscribed to the ICvar hooks\n" );
+}
+
+static void Own( )
+{
+	if( !Proxy::Initialize( global::icvar, &proxy ) )
+	{
+		Warning( "[concommandx] failed to hook ICvar, unregistered commands may be left dangling\n" );
+		return;
+	}
+
+	main_thread = std::this_thread::get_id( );
+	Proxy::Hook( &ICvar::RegisterConCommand, &Proxy::RegisterConCommand );
+	Proxy::Hook( &ICvar::UnregisterConCommand, &Proxy::UnregisterConCommand );
+	Proxy::Hook( &ICvar::UnregisterConCommands, &Proxy::UnregisterConCommands );
+
+	broker = new Broker( );
+	broker->listeners[0] = &listener;
+	broker->update = Update;
+	owner = true;
+	global::icvar->RegisterConCommand( broker );
+	Update( );
+	registry::Track( true );
+}
+
+static void Initialize( )
+{
+	// walked by hand, FCVAR_DEVELOPMENTONLY commands may be hidden from lookups
+	for( ConCommandBase *base = global::icvar->GetCommands( ); base != nullptr; base = base->m_pNext )
+		if( base->IsCommand( ) && std::strcmp( base->GetName( ), broker_name ) == 0 )
+		{
+			Subscribe( static_cast<Broker *>( base ) );
+			return;
+		}
+
+	Own( );
+}
+
+static void Deinitialize( )
+{
+	if( broker == nullptr )
+		return;
+
+	registry::Track( false );
+	for( size_t k = 0; k < max_listeners; ++k )
+		if( broker->listeners[k] == &listener )
+			broker->listeners[k] = nullptr;
+
+	if( !owner )
+	{
+		broker->update( );
+		broker = nullptr;
+		return;
+	}
+
+	// still hooked, so the subscribers hear about the broker going away
+	global::icvar->UnregisterConCommand( broker );
+
+	Proxy::UnHook( &ICvar::RegisterConCommand );
+	Proxy::UnHook( &ICvar::UnregisterConCommand );
+	Proxy::UnHook( &ICvar::UnregisterConCommands );
+	if( finding )
+	{
+		Proxy::UnHook( Proxy::find_command_base );
+		Proxy::UnHook( Proxy::find_command );
+		finding = false;
+	}
+
+	Listener *subscribers[max_listeners];
+	std::copy( broker->listeners, broker->listeners + max_listeners, subscribers );
+	delete broker;
+	broker = nullptr;
+	owner = false;
+
+	for( size_t k = 0; k < max_listeners; ++k )
+		if( subscribers[k] != nullptr )
+			subscribers[k]->orphaned( );
+}
+
+static void Orphaned( )
+{
+	broker = nullptr;
+	registry::Track( false );
+	Initialize( );
+}
+
+}
+
+// Declared with the interceptors, it needs the broker.
+bool interceptors::Unwrap( const Interceptor *interceptor )
+{
+	if( cvarhooks::broker == nullptr )
+		return false;
+
+	for( size_t k = 0; k < cvarhooks::max_listeners; ++k )
+	{
+		cvarhooks::Listener *other = cvarhooks::broker->listeners[k];
+		if( other != nullptr && other != &cvarhooks::listener &&
+			other->unwrapping( interceptor->command, interceptor, interceptor->original ) )
+			return true;
+	}
+
+	return false;
+}
+
+namespace concommand
+{
+
+struct Container
+{
+	handles::Handle handle;
+	const char *name_original;
+	const char *help_original;
+	// interned strings set over the originals, nullptr if none
+	const char *name_override;
+	const char *help_override;
+	// Lua strings last pushed by the getters, and the pointers they came from
+	const char *name_cached;
+	int32_t name_reference;
+	const char *help_cached;
+	int32_t help_reference;
+};
+
+static const char *metaname = "concommand";
+static int32_t metatype = -1;
+static const char *invalid_error = "invalid concommand";
+// registry references to the userdata of every command pushed so far
+static PointerMap<int32_t> objects;
+
+inline void CheckType( GarrysMod::Lua::ILuaBase *LUA, int32_t index )
+{
+	if( !LUA->IsType( index, metatype ) )
+		LUA->TypeError( index, metaname );
+}
+
+inline Container *GetUserdata( GarrysMod::Lua::ILuaBase *LUA, int32_t index )
+{
+	return LUA->GetUserType<Container>( index, metatype );
+}
+
+static ConCommand *Get( GarrysMod::Lua::ILuaBase *LUA, int32_t index )
+{
+	CheckType( LUA, index );
+	ConCommand *command = handles::Resolve( LUA->GetUserType<Container>( index, metatype )->handle );
+	if( command == nullptr )
+		LUA->ArgError( index, invalid_error );
+
+	return command;
+}
+
+inline void Push( GarrysMod::Lua::ILuaBase *LUA, ConCommand *command )
+{
+	if( command == nullptr )
+	{
+		LUA->PushNil( );
+		return;
+	}
+
+	int32_t *reference = objects.Find( command );
+	if( reference != nullptr )
+	{
+		LUA->ReferencePush( *reference );
+		if( handles::Resolve( GetUserdata( LUA, -1 )->handle ) == command )
+			return;
+
+		// a command that went away left its object here, at the same address
+		LUA->Pop( 1 );
+		LUA->ReferenceFree( *reference );
+		objects.Erase( command );
+	}
+
+	Container *udata = LUA->NewUserType<Container>( metatype );
+	udata->handle = handles::Acquire( command );
+	udata->name_original = command->m_pszName;
+	udata->help_original = command->m_pszHelpString;
+	udata->name_override = nullptr;
+	udata->help_override = nullptr;
+	udata->name_cached = nullptr;
+	udata->name_reference = -1;
+	udata->help_cached = nullptr;
+	udata->help_reference = -1;
+
+	LUA->PushMetaTable( metatype );
+	LUA->SetMetaTable( -2 );
+
+	LUA->CreateTable( );
+	LUA->SetFEnv( -2 );
+
+	LUA->Push( -1 );
+	objects.Insert( command, LUA->ReferenceCreate( ) );
+}
+
+// Pushes a string through a registry reference kept in the container, so
+// repeated getters don't hash and intern it in Lua again.
+inline void PushCached(
+	GarrysMod::Lua::ILuaBase *LUA,
+	const char *text,
+	const char *&cached,
+	int32_t &reference
+)
+{
+	if( reference != -1 )
+	{
+		if( cached == text )
+		{
+			LUA->ReferencePush( reference );
+			return;
+		}
+
+		LUA->ReferenceFree( reference );
+	}
+
+	LUA->PushString( text );
+	LUA->Push( -1 );
+	reference = LUA->ReferenceCreate( );
+	cached = text;
+}
+
+inline void Uncache( GarrysMod::Lua::ILuaBase *LUA, const char *&cached, int32_t &reference )
+{
+	if( reference != -1 )
+		LUA->ReferenceFree( reference );
+
+	reference = -1;
+	cached = nullptr;
+}
+
+// Puts the original name and help text back and releases the overrides.
+// Overrides of commands that went away are never released, the engine may
+// still point at them if the command comes back.
+inline void Restore( Container *udata, ConCommand *command )
+{
+	command->m_pszName = udata->name_original;
+	command->m_pszHelpString = udata->help_original;
+	strings::Release( udata->name_override );
+	strings::Release( udata->help_override );
+	udata->name_override = nullptr;
+	udata->help_override = nullptr;
+}
+
+inline ConCommand *Destroy( GarrysMod::Lua::ILuaBase *LUA, int32_t index )
+{
+	Container *udata = GetUserdata( LUA, 1 );
+	ConCommand *command = handles::Resolve( udata->handle );
+	if( command == nullptr )
+		return nullptr;
+
+	int32_t *reference = objects.Find( command );
+	if( reference != nullptr )
+	{
+		LUA->ReferenceFree( *reference );
+		objects.Erase( command );
+	}
+
+	Uncache( LUA, udata->name_cached, udata->name_reference );
+	Uncache( LUA, udata->help_cached, udata->help_reference );
+
+	Restore( udata, command );
+	handles::Release( command );
+
+	return command;
+}
+
+LUA_FUNCTION_STATIC( gc )
+{
+	if( !LUA->IsType( 1, metatype ) )
+		return 0;
+
+	Destroy( LUA, 1 );
+	return 0;
+}
+
+LUA_FUNCTION_STATIC( eq )
+{
+	LUA->PushBool( Get( LUA, 1 ) == Get( LUA, 2 ) );
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( tostring )
+{
+	LUA->PushFormattedString( "%s: %p", metaname, Get( LUA, 1 ) );
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( index )
+{
+	LUA->PushMetaTable( metatype );
+	LUA->Push( 2 );
+	LUA->RawGet( -2 );
+	if( !LUA->IsType( -1, GarrysMod::Lua::Type::NIL ) )
+		return 1;
+
+	LUA->Pop( 2 );
+
+	LUA->GetFEnv( 1 );
+	LUA->Push( 2 );
+	LUA->RawGet( -2 );
+	return 1;
+}
+
+// Objects share a metatable that is its own __index, so method lookups never
+// leave the VM. The first field stored on an object moves it to a metatable
+// of its own, with the same entries (keeping __eq comparable) but the C
+// __index above, which looks in the shared metatable and then in the
+// object's environment.
+LUA_FUNCTION_STATIC( newindex )
+{
+	LUA->GetMetaTable( 1 );
+	LUA->PushMetaTable( metatype );
+	if( LUA->RawEqual( -1, -2 ) != 0 )
+	{
+		LUA->CreateTable( );
+
+		LUA->PushNil( );
+		while( LUA->Next( -3 ) != 0 )
+		{
+			LUA->Push( -2 );
+			LUA->Push( -2 );
+			LUA->RawSet( -5 );
+			LUA->Pop( 1 );
+		}
+
+		LUA->PushCFunction( index );
+		LUA->SetField( -2, "__index" );
+
+		LUA->SetMetaTable( 1 );
+	}
+
+	LUA->Pop( 2 );
+
+	LUA->GetFEnv( 1 );
+	LUA->Push( 2 );
+	LUA->Push( 3 );
+	LUA->RawSet( -3 );
+	return 0;
+}
+
+LUA_FUNCTION_STATIC( GetName )
+{
+	ConCommand *command = Get( LUA, 1 );
+	Container *udata = GetUserdata( LUA, 1 );
+	PushCached( LUA, command->GetName( ), udata->name_cached, udata->name_reference );
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( SetName )
+{
+	Container *udata = GetUserdata( LUA, 1 );
+	ConCommand *command = handles::Resolve( udata->handle );
+	if( command == nullptr )
+		LUA->ThrowError( invalid_error );
+
+	const char *name = LUA->CheckString( 2 );
+
+	// the previous override is released last, so the new one can't reuse it
+	const char *previous = udata->name_override;
+	registry::EraseName( command );
+	command->m_pszName = udata->name_override = strings::Intern( name );
+	registry::InsertName( command );
+	strings::Release( previous );
+	Uncache( LUA, udata->name_cached, udata->name_reference );
+	search::Invalidate( );
+
+	return 0;
+}
+
+LUA_FUNCTION_STATIC( SetFlags )
+{
+	registry::SetFlags( Get( LUA, 1 ), static_cast<int32_t>( LUA->CheckNumber( 2 ) ) );
+	return 0;
+}
+
+LUA_FUNCTION_STATIC( GetFlags )
+{
+	LUA->PushNumber( Get( LUA, 1 )->m_nFlags );
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( HasFlag )
+{
+	LUA->Push( Get( LUA, 1 )->IsFlagSet( static_cast<int32_t>( LUA->CheckNumber( 2 ) ) ) );
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( SetHelpText )
+{
+	Container *udata = GetUserdata( LUA, 1 );
+	ConCommand *command = handles::Resolve( udata->handle );
+	if( command == nullptr )
+		LUA->ThrowError( invalid_error );
+
+	const char *previous = udata->help_override;
+	command->m_pszHelpString = udata->help_override = strings::Intern( LUA->CheckString( 2 ) );
+	strings::Release( previous );
+	Uncache( LUA, udata->help_cached, udata->help_reference );
+	search::Invalidate( );
+
+	return 0;
+}
+
+LUA_FUNCTION_STATIC( GetHelpText )
+{
+	ConCommand *command = Get( LUA, 1 );
+	Container *udata = GetUserdata( LUA, 1 );
+	PushCached( LUA, command->GetHelpText( ), udata->help_cached, udata->help_reference );
+	return 1;
+}
+
+// Runs the command right away on this thread, bypassing the engine command
+// buffer (and with it the checks the engine does before dispatching).
+inline void Invoke( ConCommand *command, const CCommand &args )
+{
+
+#if defined CONCOMMANDX_SERVER
+
+	// dispatched by the server itself, even from inside a client's command
+	const int32_t client = ratelimit::client;
+	ratelimit::client = -1;
+	command->Dispatch( args );
+	ratelimit::client = client;
+
+#else
+
+	command->Dispatch( args );
+
+#endif
+
+}
+
+// Tokenizes a command line that can run through ConCommand::Dispatch, without
+// going through (and flushing) the engine's command buffer. Only a line
+// holding a single registered ConCommand can, returns nullptr for anything
+// else (convars, aliases, several ';' separated commands).
+static ConCommand *Parse( const std::string &line, CCommand &args )
+{
+	const std::string text( line, 0, line.find_last_not_of( "\r\n" ) + 1 );
+
+	bool quoted = false;
+	for( size_t k = 0; k < text.size( ); ++k )
+	{
+		const char c = text[k];
+		if( c == '"' )
+			quoted = !quoted;
+		else if( c == '\n' || c == '\r' || ( c == ';' && !quoted ) )
+			return nullptr;
+	}
+
+	if( !args.Tokenize( text.c_str( ) ) || args.ArgC( ) == 0 )
+		return nullptr;
+
+	return registry::Find( args[0] );
+}
+
+LUA_FUNCTION_STATIC( Dispatch )
+{
+	ConCommand *command = Get( LUA, 1 );
+
+	const int32_t argc = LUA->Top( );
+	if( argc > CCommand::COMMAND_MAX_ARGC )
+		LUA->ThrowError( "too many arguments to dispatch" );
+
+	const char *argv[CCommand::COMMAND_MAX_ARGC];
+	argv[0] = command->GetName( );
+
+	// every argument may be quoted and followed by a space in the ArgS buffer
+	size_t length = std::strlen( argv[0] ) + 3;
+	for( int32_t i = 2; i <= argc; ++i )
+	{
+		if( !LUA->IsType( i, GarrysMod::Lua::Type::STRING ) &&
+			!LUA->IsType( i, GarrysMod::Lua::Type::NUMBER ) )
+			LUA->TypeError( i, "string" );
+
+		argv[i - 1] = LUA->GetString( i );
+		length += std::strlen( argv[i - 1] ) + 3;
+	}
+
+	if( length > CCommand::COMMAND_MAX_LENGTH )
+		LUA->ThrowError( "arguments are longer than the engine allows" );
+
+	// the argc/argv constructor only clears the first byte of the ArgS buffer
+	// and never terminates it, so it's built over zeroed memory, and it leaves
+	// ArgS starting at the space after the name, which Tokenize skips
+	alignas( CCommand ) char storage[sizeof( CCommand )] = { 0 };
+	CCommand &args = *new( storage ) CCommand( argc, argv );
+	if( argc > 1 )
+		++args.m_nArgv0Size;
+
+	Invoke( command, args );
+	return 0;
+}
+
+LUA_FUNCTION_STATIC( Remove )
+{
+	CheckType( LUA, 1 );
+	registry::Verify( );
+
+	// drop the name it's indexed under before Destroy restores the original
+	ConCommand *command = handles::Resolve( GetUserdata( LUA, 1 )->handle );
+	if( command != nullptr )
+		registry::EraseName( command );
+
+	command = Destroy( LUA, 1 );
+	if( command != nullptr )
+	{
+		global::icvar->UnregisterConCommand( command );
+		registry::Remove( command );
+		interceptors::Detach( command );
+		handlers::Destroy( LUA, command );
+	}
+
+	return 0;
+}
+
+static void Initialize( GarrysMod::Lua::ILuaBase *LUA )
+{
+	metatype = LUA->CreateMetaTable( metaname );
+
+	LUA->PushCFunction( gc );
+	LUA->SetField( -2, "__gc" );
+
+	LUA->PushCFunction( tostring );
+	LUA->SetField( -2, "__tostring" );
+
+	LUA->PushCFunction( eq );
+	LUA->SetField( -2, "__eq" );
+
+	LUA->Push( -1 );
+	LUA->SetField( -2, "__index" );
+
+	LUA->PushCFunction( newindex );
+	LUA->SetField( -2, "__newindex" );
+
+	LUA->PushCFunction( GetName );
+	LUA->SetField( -2, "GetName" );
+
+	LUA->PushCFunction( SetName );
+	LUA->SetField( -2, "SetName" );
+
+	LUA->PushCFunction( SetFlags );
+	LUA->SetField( -2, "SetFlags" );
+
+	LUA->PushCFunction( GetFlags );
+	LUA->SetField( -2, "GetFlags" );
+
+	LUA->PushCFunction( HasFlag );
+	LUA->SetField( -2, "HasFlag" );
+
+	LUA->PushCFunction( SetHelpText );
+	LUA->SetField( -2, "SetHelpText" );
+
+	LUA->PushCFunction( GetHelpText );
+	LUA->SetField( -2, "GetHelpText" );
+
+	LUA->PushCFunction( Dispatch );
+	LUA->SetField( -2, "Dispatch" );
+
+	LUA->PushCFunction( Remove );
+	LUA->SetField( -2, "Remove" );
+
+	LUA->Pop( 1 );
+}
+
+static void Deinitialize( GarrysMod::Lua::ILuaBase *LUA )
+{
+	// restore what was changed now, the objects may outlive the module
+	objects.ForEach( [LUA]( const void *, int32_t &reference )
+	{
+		LUA->ReferencePush( reference );
+		Container *udata = GetUserdata( LUA, -1 );
+		ConCommand *command = handles::Resolve( udata->handle );
+		if( command != nullptr )
+			Restore( udata, command );
+
+		Uncache( LUA, udata->name_cached, udata->name_reference );
+		Uncache( LUA, udata->help_cached, udata->help_reference );
+		LUA->Pop( 1 );
+
+		LUA->ReferenceFree( reference );
+	} );
+	objects.Clear( );
+	handles::Deinitialize( );
+
+	LUA->PushNil( );
+	LUA->SetField( GarrysMod::Lua::INDEX_REGISTRY, metaname );
+}
+
+}
+
+namespace submissions
+{
+
+// Commands submitted by other threads through ConCommandX_Submit, handed to
+// the engine by the main thread from the scheduler's Think hook.
+
+static CommandQueue<1024, CCommand::COMMAND_MAX_LENGTH> queue;
+
+inline bool Push( const char *command )
+{
+	return queue.Push( command );
+}
+
+// Hands every queued command to the engine, main thread only.
+static size_t Drain( )
+{
+	return queue.Drain( []( const char *command )
+	{
+
+#if defined CONCOMMANDX_SERVER
+
+		global::ivengine->ServerCommand( command );
+
+#elif defined CONCOMMANDX_CLIENT
+
+		global::ivengine->ClientCmd( command );
+
+#endif
+
+	} );
+}
+
+static void Initialize( )
+{
+	queue.Open( );
+}
+
+static void Deinitialize( )
+{
+	queue.Close( );
+}
+
+}
+
+// C entry point for other native modules, callable from any thread while the
+// module is loaded. Queues a command for the main thread to execute on its
+// next tick, returning false when the queue is full or the command too long.
+DLL_EXPORT bool ConCommandX_Submit( const char *command )
+{
+	return command != nullptr && submissions::Push( command );
+}
+
+namespace scheduler
+{
+
+// Commands queued by concommand.Schedule, run from a Think hook until the
+// tick's time budget is used up (but at least one per tick, so the queue
+// always moves). Lines that can't be dispatched right away (see Run) are
+// handed to the engine's command buffer instead, they are counted rather than
+// timed and only so many bytes of them go per tick. The engine runs its
+// buffer before the next Think, so a job that buffered a line waits for the
+// next tick before running another, keeping its lines in order. Jobs wait in
+// a heap ordered by due time until their delay passes, then in a heap ordered
+// by priority and submission order. Cancelled jobs stay in the job map until
+// they reach the top of a heap.
+
+typedef std::chrono::steady_clock Clock;
+
+struct Job
+{
+	std::vector<std::string> commands;
+	size_t next;
+	double priority;
+	uint64_t sequence;
+	Clock::time_point due;
+	bool cancelled;
+};
+
+static const char *hook_name = "concommandx_scheduler";
+static std::unordered_map<uint32_t, Job> jobs;
+static std::vector<uint32_t> waiting;
+static std::vector<uint32_t> ready;
+// jobs that buffered a line this tick, back in ready once it ends
+static std::vector<uint32_t> held;
+static uint32_t last_id = 0;
+static uint64_t sequence = 0;
+static Clock::duration budget = std::chrono::microseconds( 2000 );
+// bytes of lines handed to the engine's command buffer per tick, it's finite
+static const size_t max_buffered = 4096;
+
+// commands not run yet and statistics for concommand.GetScheduleStats
+static size_t pending = 0;
+static size_t peak_pending = 0;
+static uint64_t executed = 0;
+static uint64_t buffered = 0;
+static uint64_t cancelled = 0;
+static uint64_t busy_ticks = 0;
+static size_t last_executed = 0;
+static double last_time = 0.0;
+
+inline bool DueLater( uint32_t a, uint32_t b )
+{
+	return jobs.at( a ).due > jobs.at( b ).due;
+}
+
+inline bool RunsLater( uint32_t a, uint32_t b )
+{
+	const Job &first = jobs.at( a ), &second = jobs.at( b );
+	if( first.priority != second.priority )
+		return first.priority < second.priority;
+
+	return first.sequence > second.sequence;
+}
+
+// Scheduled lines never bypass the engine's checks: only a line holding a
+// single ConCommand the engine would run anyway is dispatched right away.
+// Cheat commands, and on the client commands ClientCmd refuses (those without
+// FCVAR_CLIENTCMD_CAN_EXECUTE), go to the engine's command buffer like any
+// other line, where the engine decides. Returns true if the line was
+// dispatched.
+inline bool Direct( const ConCommand *command )
+{
+
+#if defined CONCOMMANDX_SERVER
+
+	return !command->IsFlagSet( FCVAR_CHEAT );
+
+#elif defined CONCOMMANDX_CLIENT
+
+	return !command->IsFlagSet( FCVAR_CHEAT ) && command->IsFlagSet( FCVAR_CLIENTCMD_CAN_EXECUTE );
+
+#endif
+
+}
+
+// Dispatches the line if it can go direct and returns true. Anything else is
+// added to the engine's command buffer, without executing it, so whatever else
+// was buffered isn't run from inside this tick.
+inline bool Run( const std::string &line )
+{
+	CCommand args;
+	ConCommand *command = concommand::Parse( line, args );
+	if( command != nullptr && Direct( command ) )
+	{
+		concommand::Invoke( command, args );
+		return true;
+	}
+
+#if defined CONCOMMANDX_SERVER
+
+	global::ivengine->ServerCommand( line.c_str( ) );
+
+#elif defined CONCOMMANDX_CLIENT
+
+	global::ivengine->ClientCmd( line.c_str( ) );
+
+#endif
+
+	return false;
+}
+
+static uint32_t Add( std::vector<std::string> &commands, double priority, double delay )
+{
+	const uint32_t id = ++last_id;
+	Job &job = jobs[id];
+	job.commands.swap( commands );
+	job.next = 0;
+	job.priority = priority;
+	job.sequence = sequence++;
+	job.due = Clock::now( ) + std::chrono::duration_cast<Clock::duration>(
+		std::chrono::duration<double>( delay )
+	);
+	job.cancelled = false;
+
+	pending += job.commands.size( );
+	peak_pending = std::max( peak_pending, pending );
+
+	if( delay > 0.0 )
+	{
+		waiting.push_back( id );
+		std::push_heap( waiting.begin( ), waiting.end( ), DueLater );
+	}
+	else
+	{
+		ready.push_back( id );
+		std::push_heap( ready.begin( ), ready.end( ), RunsLater );
+	}
+
+	return id;
+}
+
+static bool Cancel( uint32_t id )
+{
+	std::unordered_map<uint32_t, Job>::iterator it = jobs.find( id );
+	if( it == jobs.end( ) || it->second.cancelled )
+		return false;
+
+	Job &job = it->second;
+	pending -= job.commands.size( ) - job.next;
+	job.cancelled = true;
+	std::vector<std::string>( ).swap( job.commands );
+	job.next = 0;
+	++cancelled;
+	return true;
+}
+
+LUA_FUNCTION_STATIC( Think )
+{
+	submissions::Drain( );
+	reordering::Tick( );
+
+	if( jobs.empty( ) )
+		return 0;
+
+	const Clock::time_point start = Clock::now( );
+	while( !waiting.empty( ) && jobs.at( waiting.front( ) ).due <= start )
+	{
+		const uint32_t id = waiting.front( );
+		std::pop_heap( waiting.begin( ), waiting.end( ), DueLater );
+		waiting.pop_back( );
+
+		ready.push_back( id );
+		std::push_heap( ready.begin( ), ready.end( ), RunsLater );
+	}
+
+	size_t count = 0, buffered_length = 0;
+	while( !ready.empty( ) )
+	{
+		const uint32_t id = ready.front( );
+		Job &job = jobs.at( id );
+		if( !job.cancelled && ( count != 0 || buffered_length != 0 ) &&
+			( Clock::now( ) - start >= budget || buffered_length >= max_buffered ) )
+			break;
+
+		// the job leaves the heap while its command runs, since the command may
+		// schedule or cancel jobs
+		std::pop_heap( ready.begin( ), ready.end( ), RunsLater );
+		ready.pop_back( );
+
+		bool hold = false;
+		if( !job.cancelled && job.next < job.commands.size( ) )
+		{
+			const std::string command = job.commands[job.next++];
+			--pending;
+			if( Run( command ) )
+			{
+				++count;
+			}
+			else
+			{
+				++buffered;
+				buffered_length += command.size( );
+				hold = true;
+			}
+		}
+
+		// map elements never move, so job is still valid here
+		if( job.cancelled || job.next >= job.commands.size( ) )
+		{
+			jobs.erase( id );
+		}
+		else if( hold )
+		{
+			held.push_back( id );
+		}
+		else
+		{
+			ready.push_back( id );
+			std::push_heap( ready.begin( ), ready.end( ), RunsLater );
+		}
+	}
+
+	for( size_t k = 0; k < held.size( ); ++k )
+	{
+		ready.push_back( held[k] );
+		std::push_heap( ready.begin( ), ready.end( ), RunsLater );
+	}
+
+	held.clear( );
+
+	if( count != 0 )
+	{
+		executed += count;
+		++busy_ticks;
+		last_executed = count;
+		last_time = std::chrono::duration<double>( Clock::now( ) - start ).count( );
+	}
+
+	return 0;
+}
+
+static void Initialize( GarrysMod::Lua::ILuaBase *LUA )
+{
+	LUA->GetField( GarrysMod::Lua::INDEX_GLOBAL, "hook" );
+	if( LUA->IsType( -1, GarrysMod::Lua::Type::TABLE ) )
+	{
+		LUA->GetField( -1, "Add" );
+		LUA->PushString( "Think" );
+		LUA->PushString( hook_name );
+		LUA->PushCFunction( Think );
+		LUA->Call( 3, 0 );
+	}
+
+	LUA->Pop( 1 );
+}
+
+static void Deinitialize( GarrysMod::Lua::ILuaBase *LUA )
+{
+	LUA->GetField( GarrysMod::Lua::INDEX_GLOBAL, "hook" );
+	if( LUA->IsType( -1, GarrysMod::Lua::Type::TABLE ) )
+	{
+		LUA->GetField( -1, "Remove" );
+		LUA->PushString( "Think" );
+		LUA->PushString( hook_name );
+		LUA->Call( 2, 0 );
+	}
+
+	LUA->Pop( 1 );
+
+	jobs.clear( );
+	waiting.clear( );
+	ready.clear( );
+	held.clear( );
+	pending = 0;
+}
+
+}
+
+namespace capture
+{
+
+// Console output capture for concommand.Capture. While a command runs, a spew
+// output function copies what the main thread prints into a preallocated ring
+// buffer, keeping only the newest output if it overflows. In streaming mode
+// the buffer is handed to a Lua callback in chunks instead, so it never
+// overflows. Output from other threads, asserts and errors pass through.
+
+static const size_t capacity = 65536;
+static const size_t chunk_size = 4096;
+
+static char ring[capacity];
+static size_t start = 0;
+static size_t length = 0;
+static size_t total = 0;
+static bool truncated = false;
+static bool active = false;
+static bool echo = false;
+static bool flushing = false;
+static int32_t callback = -1;
+static SpewOutputFunc_t original = nullptr;
+static std::thread::id owner;
+
+static void Append( const char *text, size_t size )
+{
+	if( size > capacity )
+	{
+		text += size - capacity;
+		size = capacity;
+		truncated = true;
+	}
+
+	if( length + size > capacity )
+	{
+		const size_t drop = length + size - capacity;
+		start = ( start + drop ) % capacity;
+		length -= drop;
+		truncated = true;
+	}
+
+	const size_t end = ( start + length ) % capacity;
+	const size_t first = std::min( size, capacity - end );
+	std::memcpy( ring + end, text, first );
+	std::memcpy( ring, text + first, size - first );
+	length += size;
+}
+
+// Makes the buffered output contiguous at the start of the ring.
+inline void Linearize( )
+{
+	std::rotate( ring, ring + start, ring + capacity );
+	start = 0;
+}
+
+static void Flush( )
+{
+	GarrysMod::Lua::ILuaBase *LUA = global::lua;
+
+	Linearize( );
+	flushing = true;
+	LUA->ReferencePush( callback );
+	LUA->PushString( ring, static_cast<unsigned int>( length ) );
+	if( LUA->PCall( 1, 0, 0 ) != 0 )
+	{
+		Warning( "[concommandx] capture callback failed: %s\n", LUA->GetString( -1 ) );
+		LUA->Pop( 1 );
+	}
+
+	flushing = false;
+	length = 0;
+}
+
+static SpewRetval_t Spew( SpewType_t type, const char *message )
+{
+	if( !active || flushing || std::this_thread::get_id( ) != owner ||
+		( type != SPEW_MESSAGE && type != SPEW_WARNING && type != SPEW_LOG ) )
+		return original( type, message );
+
+	size_t size = std::strlen( message );
+	total += size;
+	if( callback == -1 )
+	{
+		Append( message, size );
+	}
+	else
+	{
+		for( const char *text = message; size != 0; )
+		{
+			const size_t piece = std::min( size, capacity - length );
+			Append( text, piece );
+			text += piece;
+			size -= piece;
+
+			if( length >= chunk_size )
+				Flush( );
+		}
+	}
+
+	return echo ? original( type, message ) : SPEW_CONTINUE;
+}
+
+static void Begin( int32_t reference, bool echoing )
+{
+	start = 0;
+	length = 0;
+	total = 0;
+	truncated = false;
+	echo = echoing;
+	callback = reference;
+	owner = std::this_thread::get_id( );
+	original = GetSpewOutputFunc( );
+	active = true;
+	SpewOutputFunc( Spew );
+}
+
+static void End( )
+{
+	if( callback != -1 && length != 0 )
+		Flush( );
+
+	active = false;
+	// someone else may have installed their own function on top of ours
+	if( GetSpewOutputFunc( ) == Spew )
+		SpewOutputFunc( original );
+
+	callback = -1;
+}
+
+}
+
+namespace concommands
+{
+
+LUA_FUNCTION_STATIC( Exists )
+{
+	LUA->CheckType( 1, GarrysMod::Lua::Type::STRING );
+
+	LUA->PushBool( registry::Find( LUA->GetString( 1 ) ) != nullptr );
+	return 1;
+}
+
+// GetAll results are cached per registry generation, so repeated calls only
+// copy the previous table instead of pushing every command again.
+static int32_t snapshot_ref = -1;
+static uint32_t snapshot_generation = 0;
+
+static void PushSnapshot( GarrysMod::Lua::ILuaBase *LUA )
+{
+	registry::Verify( );
+	if( snapshot_ref != -1 && snapshot_generation == registry::generation )
+	{
+		LUA->ReferencePush( snapshot_ref );
+		return;
+	}
+
+	if( snapshot_ref != -1 )
+		LUA->ReferenceFree( snapshot_ref );
+
+	LUA->CreateTable( );
+
+	const std::vector<ConCommand *> &commands = registry::commands;
+	for( size_t i = 0; i < commands.size( ); ++i )
+	{
+		concommand::Push( LUA, commands[i] );
+		LUA->PushNumber( i + 1 );
+		LUA->SetTable( -3 );
+	}
+
+	LUA->Push( -1 );
+	snapshot_ref = LUA->ReferenceCreate( );
+	snapshot_generation = registry::generation;
+}
+
+// concommand.GetAll( [shared] ) returns a new table of every concommand, or
+// when shared is true the cached table itself, which every caller asking for
+// it gets and must not modify.
+LUA_FUNCTION_STATIC( GetAll )
+{
+	PushSnapshot( LUA );
+
+	if( LUA->IsType( 1, GarrysMod::Lua::Type::BOOL ) && LUA->GetBool( 1 ) )
+		return 1;
+
+	LUA->CreateTable( );
+	LUA->Push( -2 );
+	LUA->PushNil( );
+	while( LUA->Next( -2 ) != 0 )
+	{
+		LUA->Push( -2 );
+		LUA->Insert( -2 );
+		LUA->RawSet( -5 );
+	}
+
+	LUA->Pop( 1 );
+	return 1;
+}
+
+// Generic for iterator, the state is the flags mask and the control variable
+// is the last concommand returned, whose m_pNext is where the walk resumes.
+// Unregistering that command resets its m_pNext, which ends the iteration.
+LUA_FUNCTION_STATIC( IterateNext )
+{
+	const int32_t mask = static_cast<int32_t>( LUA->GetNumber( 1 ) );
+
+	ConCommandBase *base = nullptr;
+	if( LUA->IsType( 2, GarrysMod::Lua::Type::NIL ) )
+	{
+		base = global::icvar->GetCommands( );
+	}
+	else
+	{
+		concommand::CheckType( LUA, 2 );
+		ConCommand *previous = handles::Resolve( concommand::GetUserdata( LUA, 2 )->handle );
+		if( previous == nullptr || !previous->m_bRegistered )
+			return 0;
+
+		base = previous->m_pNext;
+	}
+
+	for( ; base != nullptr; base = base->m_pNext )
+		if( base->IsCommand( ) && ( mask == 0 || ( base->m_nFlags & mask ) != 0 ) )
+		{
+			concommand::Push( LUA, static_cast<ConCommand *>( base ) );
+			return 1;
+		}
+
+	return 0;
+}
+
+LUA_FUNCTION_STATIC( Iterate )
+{
+	int32_t mask = 0;
+	if( !LUA->IsType( 1, GarrysMod::Lua::Type::NIL ) )
+		mask = static_cast<int32_t>( LUA->CheckNumber( 1 ) );
+
+	LUA->PushCFunction( IterateNext );
+	LUA->PushNumber( mask );
+	return 2;
+}
+
+static registry::Match CheckMatch( GarrysMod::Lua::ILuaBase *LUA, int32_t index )
+{
+	if( LUA->IsType( index, GarrysMod::Lua::Type::NIL ) )
+		return registry::Match::All;
+
+	const char *mode = LUA->CheckString( index );
+	if( V_stricmp( mode, "all" ) == 0 )
+		return registry::Match::All;
+	else if( V_stricmp( mode, "any" ) == 0 )
+		return registry::Match::Any;
+	else if( V_stricmp( mode, "none" ) == 0 )
+		return registry::Match::None;
+
+	LUA->ArgError( index, "mode must be \"all\", \"any\" or \"none\"" );
+	return registry::Match::All;
+}
+
+LUA_FUNCTION_STATIC( GetByFlags )
+{
+	std::vector<uint32_t> matches;
+	registry::MatchFlags(
+		static_cast<int32_t>( LUA->CheckNumber( 1 ) ), CheckMatch( LUA, 2 ), matches
+	);
+
+	LUA->CreateTable( );
+
+	size_t i = 0;
+	for( size_t w = 0; w < matches.size( ); ++w )
+		for( uint32_t word = matches[w]; word != 0; word &= word - 1 )
+		{
+			LUA->PushNumber( ++i );
+			concommand::Push( LUA, registry::commands[w * 32 + registry::LowestBit( word )] );
+			LUA->SetTable( -3 );
+		}
+
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( CountByFlags )
+{
+	std::vector<uint32_t> matches;
+	registry::MatchFlags(
+		static_cast<int32_t>( LUA->CheckNumber( 1 ) ), CheckMatch( LUA, 2 ), matches
+	);
+
+	uint32_t count = 0;
+	for( size_t w = 0; w < matches.size( ); ++w )
+		count += registry::PopCount( matches[w] );
+
+	LUA->PushNumber( count );
+	return 1;
+}
+
+// Previous flags of the commands changed by each SetFlagsBulk call, so the
+// caller can revert exactly those with the returned token. The name is kept
+// too, another command may be registered at the address of one that went away.
+struct FlagsChange
+{
+	ConCommand *cmd;
+	std::string name;
+	int32_t flags;
+};
+
+static std::unordered_map<uint32_t, std::vector<FlagsChange>> flags_undo;
+static uint32_t flags_undo_last = 0;
+
+static bool ChangeFlags(
+	ConCommand *command,
+	int32_t set,
+	int32_t clear,
+	std::vector<FlagsChange> &changes
+)
+{
+	const int32_t flags = ( command->m_nFlags & ~clear ) | set;
+	if( flags == command->m_nFlags )
+		return false;
+
+	FlagsChange change = { command, command->m_pszName, command->m_nFlags };
+	changes.push_back( change );
+	registry::SetFlags( command, flags );
+	return true;
+}
+
+LUA_FUNCTION_STATIC( SetFlagsBulk )
+{
+	const int32_t set = static_cast<int32_t>( LUA->CheckNumber( 2 ) );
+	const int32_t clear = static_cast<int32_t>( LUA->CheckNumber( 3 ) );
+
+	std::vector<FlagsChange> changes;
+	if( LUA->IsType( 1, GarrysMod::Lua::Type::TABLE ) )
+	{
+		for( int32_t i = 1; ; ++i )
+		{
+			LUA->PushNumber( i );
+			LUA->RawGet( 1 );
+			if( LUA->IsType( -1, GarrysMod::Lua::Type::NIL ) )
+			{
+				LUA->Pop( 1 );
+				break;
+			}
+
+			if( !LUA->IsType( -1, GarrysMod::Lua::Type::STRING ) )
+				LUA->ArgError( 1, "name list must only contain strings" );
+
+			ConCommand *command = registry::Find( LUA->GetString( -1 ) );
+			if( command != nullptr )
+				ChangeFlags( command, set, clear, changes );
+
+			LUA->Pop( 1 );
+		}
+	}
+	else
+	{
+		const char *pattern = LUA->CheckString( 1 );
+
+		registry::Verify( );
+		const std::vector<ConCommand *> &commands = registry::commands;
+		for( size_t k = 0; k < commands.size( ); ++k )
+			if( registry::GlobMatch( pattern, commands[k]->m_pszName ) )
+				ChangeFlags( commands[k], set, clear, changes );
+	}
+
+	LUA->PushNumber( changes.size( ) );
+	if( changes.empty( ) )
+		return 1;
+
+	const uint32_t token = ++flags_undo_last;
+	flags_undo[token].swap( changes );
+	LUA->PushNumber( token );
+	return 2;
+}
+
+LUA_FUNCTION_STATIC( UndoFlags )
+{
+	const uint32_t token = static_cast<uint32_t>( LUA->CheckNumber( 1 ) );
+	std::unordered_map<uint32_t, std::vector<FlagsChange>>::iterator it = flags_undo.find( token );
+	if( it == flags_undo.end( ) )
+	{
+		LUA->PushNumber( 0 );
+		return 1;
+	}
+
+	// passing false only discards the token
+	size_t reverted = 0;
+	if( !LUA->IsType( 2, GarrysMod::Lua::Type::BOOL ) || LUA->GetBool( 2 ) )
+	{
+		registry::Verify( );
+
+		const std::vector<FlagsChange> &changes = it->second;
+		for( size_t k = 0; k < changes.size( ); ++k )
+			if( registry::Contains( changes[k].cmd ) && changes[k].name == changes[k].cmd->m_pszName )
+			{
+				registry::SetFlags( changes[k].cmd, changes[k].flags );
+				++reverted;
+			}
+	}
+
+	flags_undo.erase( it );
+	LUA->PushNumber( reverted );
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( FindByPrefix )
+{
+	const char *prefix = LUA->CheckString( 1 );
+
+	size_t limit = 0;
+	if( !LUA->IsType( 2, GarrysMod::Lua::Type::NIL ) )
+		limit = static_cast<size_t>( LUA->CheckNumber( 2 ) );
+
+	std::vector<ConCommand *> matches;
+	registry::FindByPrefix( prefix, limit, matches );
+
+	LUA->CreateTable( );
+	for( size_t i = 0; i < matches.size( ); ++i )
+	{
+		LUA->PushNumber( i + 1 );
+		concommand::Push( LUA, matches[i] );
+		LUA->SetTable( -3 );
+	}
+
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( Search )
+{
+	const char *query = LUA->CheckString( 1 );
+
+	size_t limit = 0;
+	if( !LUA->IsType( 2, GarrysMod::Lua::Type::NIL ) )
+		limit = static_cast<size_t>( LUA->CheckNumber( 2 ) );
+
+	std::vector<search::Match> matches;
+	search::Search( query, limit, matches );
+
+	LUA->CreateTable( );
+	for( size_t i = 0; i < matches.size( ); ++i )
+	{
+		LUA->PushNumber( i + 1 );
+		concommand::Push( LUA, matches[i].cmd );
+		LUA->SetTable( -3 );
+	}
+
+	return 1;
+}
+
+// Registers a real ConCommand whose callback calls fn directly with an
+// arguments view, instead of going through concommand.Add's Lua dispatch.
+LUA_FUNCTION_STATIC( Create )
+{
+	const char *name = LUA->CheckString( 1 );
+
+	const char *help = "";
+	if( !LUA->IsType( 2, GarrysMod::Lua::Type::NIL ) )
+		help = LUA->CheckString( 2 );
+
+	int32_t flags = 0;
+	if( !LUA->IsType( 3, GarrysMod::Lua::Type::NIL ) )
+		flags = static_cast<int32_t>( LUA->CheckNumber( 3 ) );
+
+	LUA->CheckType( 4, GarrysMod::Lua::Type::FUNCTION );
+
+	if( *name == '\0' || global::icvar->FindCommandBase( name ) != nullptr )
+		LUA->ArgError( 1, "a command or convar with this name already exists" );
+
+	concommand::Push( LUA, handlers::Create( LUA, name, help, flags, 4 ) );
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( SetProfiling )
+{
+	LUA->CheckType( 1, GarrysMod::Lua::Type::BOOL );
+	interceptors::profiling = LUA->GetBool( 1 );
+	interceptors::Sync( );
+	return 0;
+}
+
+// Returns { [name] = { calls, time, max, histogram } } for every command that
+// was dispatched while profiling, with times in seconds and histogram[k]
+// counting calls that took [2^(k - 1), 2^k) nanoseconds.
+LUA_FUNCTION_STATIC( GetProfile )
+{
+	interceptors::Sync( );
+
+	LUA->CreateTable( );
+	interceptors::interceptors.ForEach( [LUA]( const void *, interceptors::Interceptor *interceptor )
+	{
+		if( interceptor->calls == 0 )
+			return;
+
+		LUA->CreateTable( );
+
+		LUA->PushNumber( static_cast<double>( interceptor->calls ) );
+		LUA->SetField( -2, "calls" );
+
+		LUA->PushNumber( interceptor->total / 1e9 );
+		LUA->SetField( -2, "time" );
+
+		LUA->PushNumber( interceptor->max / 1e9 );
+		LUA->SetField( -2, "max" );
+
+		LUA->CreateTable( );
+		for( size_t k = 0; k < interceptors::histogram_buckets; ++k )
+		{
+			LUA->PushNumber( k + 1 );
+			LUA->PushNumber( static_cast<double>( interceptor->histogram[k] ) );
+			LUA->SetTable( -3 );
+		}
+
+		LUA->SetField( -2, "histogram" );
+
+		LUA->SetField( -2, interceptor->command->GetName( ) );
+	} );
+
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( ResetProfile )
+{
+	interceptors::interceptors.ForEach( []( const void *, interceptors::Interceptor *interceptor )
+	{
+		interceptor->Reset( );
+	} );
+
+	return 0;
+}
+
+#if defined CONCOMMANDX_SERVER
+
+// concommand.SetRateLimit( name or flags, rate, burst ) limits how many times
+// per second each client may run a command, or every command with any of the
+// flags when given a number, with up to burst calls at once. A nil rate
+// removes the limit. Names are case-insensitive, like command names.
+LUA_FUNCTION_STATIC( SetRateLimit )
+{
+	const int32_t type = LUA->GetType( 1 );
+	if( type != GarrysMod::Lua::Type::STRING && type != GarrysMod::Lua::Type::NUMBER )
+		LUA->TypeError( 1, "string or number" );
+
+	std::string name;
+	int32_t flags = 0;
+	if( type == GarrysMod::Lua::Type::STRING )
+		name = LUA->GetString( 1 );
+	else
+		flags = static_cast<int32_t>( LUA->GetNumber( 1 ) );
+
+	if( name.empty( ) && flags == 0 )
+		LUA->ArgError( 1, "expected a command name or non-zero flags" );
+
+	double rate = -1.0, burst = 0.0;
+	if( !LUA->IsType( 2, GarrysMod::Lua::Type::NIL ) )
+	{
+		LUA->CheckType( 2, GarrysMod::Lua::Type::NUMBER );
+		rate = LUA->GetNumber( 2 );
+		if( rate < 0.0 )
+			LUA->ArgError( 2, "rate can't be negative" );
+
+		burst = std::max( rate, 1.0 );
+		if( !LUA->IsType( 3, GarrysMod::Lua::Type::NIL ) )
+		{
+			LUA->CheckType( 3, GarrysMod::Lua::Type::NUMBER );
+			burst = LUA->GetNumber( 3 );
+			if( burst < 1.0 )
+				LUA->ArgError( 3, "burst must be at least 1" );
+		}
+
+		if( !clients::Available( ) )
+			LUA->ThrowError( "rate limiting is not available" );
+
+		if( ratelimit::rules.size( ) >= ratelimit::max_rules && !ratelimit::Exists( name, flags ) )
+			LUA->ThrowError( "too many rate limits" );
+	}
+
+	ratelimit::Set( name, flags, rate, burst );
+	interceptors::Sync( );
+	return 0;
+}
+
+// Returns a list of { target, rate, burst, dropped } for every rate limit.
+LUA_FUNCTION_STATIC( GetRateLimits )
+{
+	LUA->CreateTable( );
+	for( size_t k = 0; k < ratelimit::rules.size( ); ++k )
+	{
+		const ratelimit::Rule &rule = ratelimit::rules[k];
+
+		LUA->PushNumber( k + 1 );
+		LUA->CreateTable( );
+
+		if( rule.name.empty( ) )
+			LUA->PushNumber( rule.flags );
+		else
+			LUA->PushString( rule.name.c_str( ) );
+
+		LUA->SetField( -2, "target" );
+
+		LUA->PushNumber( rule.rate );
+		LUA->SetField( -2, "rate" );
+
+		LUA->PushNumber( rule.burst );
+		LUA->SetField( -2, "burst" );
+
+		LUA->PushNumber( static_cast<double>( rule.dropped ) );
+		LUA->SetField( -2, "dropped" );
+
+		LUA->SetTable( -3 );
+	}
+
+	return 1;
+}
+
+LUA_FUNCTION_STATIC( ClearRateLimits )
+{
+	ratelimit::Deinitialize( );
+	interceptors::Sync( );
+	return 0;
+}
+
+// concommand.SetPolicy( rules[, default] ) decides which commands clients may
+// run. rules is a list of { pattern = glob, allow = boolean } where the first
+// matching pattern wins, and default ( true if omitted ) decides the rest.
+// An empty list or nil removes the policy.
+LUA_FUNCTION_STATIC( SetPolicy )
+{
+	std::vector<policy::Rule> compiling;
+	if( !LUA->IsType( 1, GarrysMod::Lua::Type::NIL ) )
+	{
+		LUA->CheckType( 1, GarrysMod::Lua::Type::TABLE );
+
+		for( int32_t i = 1; ; ++i )
+		{
+			LUA->PushNumber( i );
+			LUA->GetTable( 1 );
+			if( LUA->IsType( -1, GarrysMod::Lua::Type::NIL ) )
+			{
+				LUA->Pop( 1 );
+				break;
+			}
+
+			if( !LUA->IsType( -1, GarrysMod::Lua::Type::TABLE ) )
+				LUA->ArgError( 1, "policy rules must be tables" );
+
+			LUA->GetField( -1, "pattern" );
+			if( !LUA->IsType( -1, GarrysMod::Lua::Type::STRING ) )
+				LUA->ArgError( 1, "policy rules need a pattern string" );
+
+			policy::Rule rule = { LUA->GetString( -1 ), false, 0 };
+			LUA->Pop( 1 );
+
+			LUA->GetField( -1, "allow" );
+			if( !LUA->IsType( -1, GarrysMod::Lua::Type::BOOL ) )
+				LUA->ArgError( 1, "policy rules need an allow boolean" );
+
+			rule.allow = LUA->GetBool( -1 );
+			LUA->Pop( 2 );
+
+			compiling.push_back( rule );
+		}
+	}
+
+	bool allow = true;
+	if( !LUA->IsType( 2, GarrysMod::Lua::Type::NIL ) )
+	{
+		LUA->CheckType( 2, GarrysMod::Lua::Type::BOOL );
+		allow = LUA->GetBool( 2 );
+	}
+
+	if( !compiling.empty( ) && !clients::Available( ) )
+		LUA->ThrowError( "command policies are not available" );
+
+	std::string error;
+	if( !policy::Set( compiling, allow, error ) )
+		LUA->ThrowError( error.c_str( ) );
+
+	interceptors::Sync( );
+	return 0;
+}
+
+// Returns the hits of every policy rule, in rule order, and the hits of the
+// default decision.
+LUA_FUNCTION_STATIC( GetPolicyHits )
+{
+	LUA->CreateTable( );
+	for( size_t k = 0; k < policy::rules.size( ); ++k )
+	{
+		LUA->PushNumber( k + 1 );
+		LUA->PushNumber( static_cast<double>( policy::rules[k].hits ) );
+		LUA->SetTable( -3 );
+	}
+
+	LUA->PushNumber( static_cast<double>( policy::default_hits ) );
+	return 2;
+}
+
+// Returns whether the policy allows a command name and the index of the rule
+// that decided, or nil for the default, without counting a hit.
+LUA_FUNCTION_STATIC( CheckPolicy )
+{
+	const uint32_t rule = policy::Match( LUA->CheckString( 1 ) );
+	if( rule == policy::no_rule )
+	{
+		LUA->PushBool( policy::default_allow );
+		return 1;
+	}
+
+	LUA->PushBool( policy::rules[rule].allow );
+	LUA->PushNumber( rule + 1 );
+	return 2;
+}
+
+#endif
+
+LUA_FUNCTION_STATIC( Get )
+{
+	concommand::Push( LUA, registry::Find( LUA->CheckString( 1 ) ) );
+	return 1;
+}
+
+#if defined CONCOMMANDX_SERVER
+
+LUA_FUNCTION_STATIC( Execute )
+{
+	global::ivengine->ServerCommand( LUA->CheckString( 1 ) );
+	return 0;
+}
+
+inline void Submit( const char *buffer, bool )
+{
+	global::ivengine->ServerCommand( buffer );
+}
+
+#elif defined CONCOMMANDX_CLIENT
+
+LUA_FUNCTION_STATIC( Execute )
+{
+	if( LUA->IsType( 2, GarrysMod::Lua::Type::BOOL ) && LUA->GetBool( 2 ) )
+		global::ivengine->ClientCmd_Unrestricted( LUA->CheckString( 1 ) );
+	else
+		global::ivengine->ClientCmd( LUA->CheckString( 1 ) );
+
+	return 0;
+}
+
+LUA_FUNCTION_STATIC( ExecuteOnServer )
+{
+	global::ivengine->ServerCmd( LUA->CheckString( 1 ) );
+	return 0;
+}
+
+inline void Submit( const char *buffer, bool unrestricted )
+{
+	if( unrestricted )
+		global::ivengine->ClientCmd_Unrestricted( buffer );
+	else
+		global::ivengine->ClientCmd( buffer );
+}
+
+#endif
+
+// Builds one command line from a batch entry, either a raw command string or
+// a table with the command name followed by its arguments, which are quoted
+// when the engine tokenizer would otherwise split them.
+static void BuildCommand( GarrysMod::Lua::ILuaBase *LUA, std::string &command )
+{
+	command.clear( );
+
+	if( LUA->IsType( -1, GarrysMod::Lua::Type::STRING ) )
+	{
+		command = LUA->GetString( -1 );
+		while( !command.empty( ) &&
+			( command.back( ) == '\n' || command.back( ) == '\r' ||
+				command.back( ) == ';' || command.back( ) == ' ' ) )
+			command.pop_back( );
+
+		if( command.find_first_of( "\r\n" ) != std::string::npos )
+			LUA->ArgError( 1, "batch commands can't contain line breaks" );
+
+		// an open quote would swallow the ';' and every command packed after it
+		if( std::count( command.begin( ), command.end( ), '"' ) % 2 != 0 )
+			LUA->ArgError( 1, "batch commands can't have unbalanced quotes" );
+
+		return;
+	}
+
+	if( !LUA->IsType( -1, GarrysMod::Lua::Type::TABLE ) )
+		LUA->ArgError( 1, "batch entries must be strings or tables" );
+
+	for( int32_t i = 1; ; ++i )
+	{
+		LUA->PushNumber( i );
+		LUA->RawGet( -2 );
+		if( LUA->IsType( -1, GarrysMod::Lua::Type::NIL ) )
+		{
+			LUA->Pop( 1 );
+			break;
+		}
+
+		if( !LUA->IsType( -1, GarrysMod::Lua::Type::STRING ) &&
+			!LUA->IsType( -1, GarrysMod::Lua::Type::NUMBER ) )
+			LUA->ArgError( 1, "batch arguments must be strings or numbers" );
+
+		const char *arg = LUA->GetString( -1 );
+		if( std::strpbrk( arg, "\"\r\n" ) != nullptr )
+			LUA->ArgError( 1, "batch arguments can't contain quotes or line breaks" );
+
+		if( i == 1 )
+		{
+			if( *arg == '\0' || std::strpbrk( arg, " \t;{}()':" ) != nullptr )
+				LUA->ArgError( 1, "invalid command name in batch" );
+
+			command = arg;
+		}
+		else
+		{
+			command += ' ';
+			if( *arg == '\0' || std::strpbrk( arg, " \t;{}()':" ) != nullptr )
+			{
+				command += '"';
+				command += arg;
+				command += '"';
+			}
+			else
+			{
+				command += arg;
+			}
+		}
+
+		LUA->Pop( 1 );
+	}
+
+	if( command.empty( ) )
+		LUA->ArgError( 1, "empty command table in batch" );
+}
+
+// Packs the list into the fewest ';' separated buffers that fit the engine's
+// command length limit (including the terminating line break) and issues one
+// engine call per buffer.
+LUA_FUNCTION_STATIC( ExecuteBatch )
+{
+	LUA->CheckType( 1, GarrysMod::Lua::Type::TABLE );
+	const bool unrestricted = LUA->IsType( 2, GarrysMod::Lua::Type::BOOL ) && LUA->GetBool( 2 );
+	const size_t max_length = static_cast<size_t>( CCommand::MaxCommandLength( ) );
+
+	std::vector<std::string> buffers;
+	std::string command;
+	for( int32_t i = 1; ; ++i )
+	{
+		LUA->PushNumber( i );
+		LUA->RawGet( 1 );
+		if( LUA->IsType( -1, GarrysMod::Lua::Type::NIL ) )
+		{
+			LUA->Pop( 1 );
+			break;
+		}
+
+		BuildCommand( LUA, command );
+		LUA->Pop( 1 );
+
+		if( command.empty( ) )
+			continue;
+
+		if( command.size( ) + 1 > max_length )
+			LUA->ArgError( 1, "batch command is longer than the engine allows" );
+
+		if( !buffers.empty( ) && buffers.back( ).size( ) + 1 + command.size( ) + 1 <= max_length )
+		{
+			buffers.back( ) += ';';
+			buffers.back( ) += command;
+		}
+		else
+		{
+			buffers.push_back( command );
+		}
+	}
+
+	for( size_t k = 0; k < buffers.size( ); ++k )
+	{
+		buffers[k] += '\n';
+		Submit( buffers[k].c_str( ), unrestricted );
+	}
+
+	LUA->PushNumber( buffers.size( ) );
+	return 1;
+}
+
+// concommand.Schedule( commands[, options] ) queues a command string, or a
+// list of entries like ExecuteBatch takes, to run over the next ticks.
+// options.priority ( 0 ) orders ready jobs, higher first, and options.delay
+// ( 0 ) is how many seconds to wait before starting. A job's commands run in
+// order and go through the engine's checks, only the ones it would run anyway
+// skip its command buffer. Returns a handle for concommand.Cancel.
+LUA_FUNCTION_STATIC( Schedule )
+{
+	std::vector<std::string> commands;
+	std::string command;
+	if( LUA->IsType( 1, GarrysMod::Lua::Type::STRING ) )
+	{
+		LUA->Push( 1 );
+		BuildCommand( LUA, command );
+		LUA->Pop( 1 );
+
+		if( !command.empty( ) )
+			commands.push_back( command + '\n' );
+	}
+	else
+	{
+		LUA->CheckType( 1, GarrysMod::Lua::Type::TABLE );
+
+		for( int32_t i = 1; ; ++i )
+		{
+			LUA->PushNumber( i );
+			LUA->RawGet( 1 );
+			if( LUA->IsType( -1, GarrysMod::Lua::Type::NIL ) )
+			{
+				LUA->Pop( 1 );
+				break;
+			}
+
+			BuildCommand( LUA, command );
+			LUA->Pop( 1 );
+
+			if( !command.empty( ) )
+				commands.push_back( command + '\n' );
+		}
+	}
+
+	const size_t max_length = static_cast<size_t>( CCommand::MaxCommandLength( ) );
+	for( size_t k = 0; k < commands.size( ); ++k )
+		if( commands[k].size( ) > max_length )
+			LUA->ArgError( 1, "scheduled command is longer than the engine allows" );
+
+	double priority = 0.0, delay = 0.0;
+	if( !LUA->IsType( 2, GarrysMod::Lua::Type::NIL ) )
+	{
+		LUA->CheckType( 2, GarrysMod::Lua::Type::TABLE );
+
+		LUA->GetField( 2, "priority" );
+		if( LUA->IsType( -1, GarrysMod::Lua::Type::NUMBER ) )
+			priority = LUA->GetNumber( -1 );
+
+		LUA->GetField( 2, "delay" );
+		if( LUA->IsType( -1, GarrysMod::Lua::Type::NUMBER ) )
+			delay = LUA->GetNumber( -1 );
+
+		LUA->Pop( 2 );
+	}
+
+	LUA->PushNumber( scheduler::Add( commands, priority, delay ) );
+	return 1;
+}
+
+// Cancels the commands of a scheduled job that haven't run yet, returning
+// whether there was anything left to cancel.
+LUA_FUNCTION_STATIC( Cancel )
+{
+	LUA->PushBool( scheduler::Cancel( static_cast<uint32_t>( LUA->CheckNumber( 1 ) ) ) );
+	return 1;
+}
+
+// Sets how many microseconds of each tick scheduled commands may use.
+LUA_FUNCTION_STATIC( SetScheduleBudget )
+{
+	const double budget = LUA->CheckNumber( 1 );
+	if( budget < 0.0 )
+		LUA->ArgError( 1, "budget can't be negative" );
+
+	scheduler::budget = std::chrono::duration_cast<scheduler::Clock::duration>(
+		std::chrono::duration<double, std::micro>( budget )
+	);
+	return 0;
+}
+
+LUA_FUNCTION_STATIC( GetScheduleStats )
+{
+	LUA->CreateTable( );
 
-	LUA->PushCFunction( SetName );
-	LUA->SetField( -2, "SetName" );
+	LUA->PushNumber( scheduler::pending );
+	LUA->SetField( -2, "pending" );
 
-	LUA->PushCFunction( SetFlags );
-	LUA->SetField( -2, "SetFlags" );
+	LUA->PushNumber( scheduler::peak_pending );
+	LUA->SetField( -2, "peak" );
 
-	LUA->PushCFunction( GetFlags );
-	LUA->SetField( -2, "GetFlags" );
+	LUA->PushNumber( scheduler::jobs.size( ) );
+	LUA->SetField( -2, "jobs" );
 
-	LUA->PushCFunction( HasFlag );
-	LUA->SetField( -2, "HasFlag" );
+	LUA->PushNumber( scheduler::waiting.size( ) );
+	LUA->SetField( -2, "delayed" );
 
-	LUA->PushCFunction( SetHelpText );
-	LUA->SetField( -2, "SetHelpText" );
+	LUA->PushNumber( static_cast<double>( scheduler::executed ) );
+	LUA->SetField( -2, "executed" );
 
-	LUA->PushCFunction( GetHelpText );
-	LUA->SetField( -2, "GetHelpText" );
+	LUA->PushNumber( static_cast<double>( scheduler::buffered ) );
+	LUA->SetField( -2, "buffered" );
 
-	LUA->PushCFunction( Remove );
-	LUA->SetField( -2, "Remove" );
+	LUA->PushNumber( static_cast<double>( scheduler::cancelled ) );
+	LUA->SetField( -2, "cancelled" );
 
-	LUA->Pop( 1 );
-}
+	LUA->PushNumber( static_cast<double>( scheduler::busy_ticks ) );
+	LUA->SetField( -2, "ticks" );
 
-static void Deinitialize( GarrysMod::Lua::ILuaBase *LUA )
-{
-	LUA->PushNil( );
-	LUA->SetField( GarrysMod::Lua::INDEX_REGISTRY, metaname );
+	LUA->PushNumber( scheduler::last_executed );
+	LUA->SetField( -2, "last_executed" );
 
-	LUA->PushNil( );
-	LUA->SetField( GarrysMod::Lua::INDEX_REGISTRY, table_name );
-}
+	LUA->PushNumber( scheduler::last_time );
+	LUA->SetField( -2, "last_time" );
 
+	return 1;
 }
 
-namespace concommands
+LUA_FUNCTION_STATIC( GetSubmissionStats )
 {
+	LUA->CreateTable( );
 
-LUA_FUNCTION_STATIC( Exists )
-{
-	LUA->CheckType( 1, GarrysMod::Lua::Type::STRING );
+	LUA->PushNumber( static_cast<double>( submissions::queue.Submitted( ) ) );
+	LUA->SetField( -2, "submitted" );
 
-	ConCommand *command = global::icvar->FindCommand( LUA->GetString( 1 ) );
-	if( command == nullptr )
-		LUA->PushBool( false );
-	else
-		LUA->PushBool( command->IsCommand( ) );
+	LUA->PushNumber( static_cast<double>( submissions::queue.Dropped( ) ) );
+	LUA->SetField( -2, "dropped" );
 
 	return 1;
 }
 
-LUA_FUNCTION_STATIC( GetAll )
+// concommand.Capture( command[, options ] ) dispatches a single registered
+// command right away and returns what it printed to the console, followed by
+// whether older output was dropped because it didn't fit. options.lines
+// returns a list of lines instead of a string, options.echo still prints the
+// output and options.callback receives the output in chunks as it's printed,
+// in which case only the amount of bytes printed is returned.
+LUA_FUNCTION_STATIC( Capture )
 {
-	LUA->CreateTable( );
+	LUA->CheckType( 1, GarrysMod::Lua::Type::STRING );
 
-	size_t i = 0;
-	ICvar::Iterator iter( global::icvar ); 
-	for( iter.SetFirst( ); iter.IsValid( ); iter.Next( ) )
-	{  
-		ConCommand *cmd = static_cast<ConCommand *>( iter.Get( ) );
-		if( cmd->IsCommand( ) )
+	if( capture::active )
+		LUA->ThrowError( "captures can't be nested" );
+
+	bool lines = false, echo = false;
+	int32_t callback = -1;
+	if( !LUA->IsType( 2, GarrysMod::Lua::Type::NIL ) )
+	{
+		LUA->CheckType( 2, GarrysMod::Lua::Type::TABLE );
+
+		LUA->GetField( 2, "lines" );
+		lines = LUA->GetBool( -1 );
+
+		LUA->GetField( 2, "echo" );
+		echo = LUA->GetBool( -1 );
+
+		LUA->Pop( 2 );
+
+		LUA->GetField( 2, "callback" );
+		if( LUA->IsType( -1, GarrysMod::Lua::Type::FUNCTION ) )
+			callback = LUA->ReferenceCreate( );
+		else
+			LUA->Pop( 1 );
+	}
+
+	std::string command;
+	LUA->Push( 1 );
+	BuildCommand( LUA, command );
+	LUA->Pop( 1 );
+
+	// running anything else would mean executing the engine's whole buffer
+	CCommand args;
+	ConCommand *target = concommand::Parse( command, args );
+	if( target == nullptr )
+	{
+		if( callback != -1 )
+			LUA->ReferenceFree( callback );
+
+		LUA->ArgError( 1, "only a single registered command can be captured" );
+	}
+
+	capture::Begin( callback, echo );
+	concommand::Invoke( target, args );
+	capture::End( );
+
+	if( callback != -1 )
+	{
+		LUA->ReferenceFree( callback );
+		LUA->PushNumber( static_cast<double>( capture::total ) );
+		return 1;
+	}
+
+	// PushString takes a length of 0 as a request to call strlen
+	capture::Linearize( );
+	if( !lines )
+	{
+		if( capture::length != 0 )
+			LUA->PushString( capture::ring, static_cast<unsigned int>( capture::length ) );
+		else
+			LUA->PushString( "" );
+	}
+	else
+	{
+		LUA->CreateTable( );
+
+		const char *text = capture::ring, *end = capture::ring + capture::length;
+		for( int32_t i = 1; text < end; ++i )
 		{
-			concommand::Push( LUA, cmd );
-			LUA->PushNumber( ++i );
+			const char *newline = static_cast<const char *>( std::memchr( text, '\n', end - text ) );
+			const char *line_end = newline != nullptr ? newline : end;
+
+			LUA->PushNumber( i );
+			if( line_end != text )
+				LUA->PushString( text, static_cast<unsigned int>( line_end - text ) );
+			else
+				LUA->PushString( "" );
+
 			LUA->SetTable( -3 );
+
+			text = newline != nullptr ? newline + 1 : end;
 		}
 	}
 
-	return 1;
+	LUA->PushBool( capture::truncated );
+	return 2;
 }
 
-LUA_FUNCTION_STATIC( Get )
+// concommand.SetReordering( enabled[, interval] ) counts command lookups and
+// relinks the engine's command list every interval seconds ( 10 by default )
+// so the most looked up commands are found first. The list is rewritten in
+// place: a concommand.Iterate loop that spans ticks can skip or repeat
+// commands, and so can engine threads walking the list at that moment.
+// Leave it off where either matters.
+LUA_FUNCTION_STATIC( SetReordering )
 {
-	concommand::Push( LUA, global::icvar->FindCommand( LUA->CheckString( 1 ) ) );
-	return 1;
-}
+	LUA->CheckType( 1, GarrysMod::Lua::Type::BOOL );
 
-#if defined CONCOMMANDX_SERVER
+	double interval = 10.0;
+	if( !LUA->IsType( 2, GarrysMod::Lua::Type::NIL ) )
+	{
+		interval = LUA->CheckNumber( 2 );
+		if( interval <= 0.0 )
+			LUA->ArgError( 2, "interval must be positive" );
+	}
 
-LUA_FUNCTION_STATIC( Execute )
-{
-	global::ivengine->ServerCommand( LUA->CheckString( 1 ) );
+	const bool enable = LUA->GetBool( 1 );
+	if( enable && !cvarhooks::Available( ) )
+		LUA->ThrowError( "reordering is not available" );
+
+	reordering::Set( enable, interval );
+	cvarhooks::SetLookups( enable );
 	return 0;
 }
 
-#elif defined CONCOMMANDX_CLIENT
-
-LUA_FUNCTION_STATIC( Execute )
+// Returns the lookups counted, how many found nothing, how many relinks were
+// done and the average list position of looked up entries before and after
+// the last one.
+LUA_FUNCTION_STATIC( GetReorderingStats )
 {
-	if( LUA->IsType( 2, GarrysMod::Lua::Type::BOOL ) && LUA->GetBool( 2 ) )
-		global::ivengine->ClientCmd_Unrestricted( LUA->CheckString( 1 ) );
-	else
-		global::ivengine->ClientCmd( LUA->CheckString( 1 ) );
+	LUA->CreateTable( );
 
-	return 0;
-}
+	LUA->PushNumber( static_cast<double>( reordering::lookups ) );
+	LUA->SetField( -2, "lookups" );
 
-LUA_FUNCTION_STATIC( ExecuteOnServer )
-{
-	global::ivengine->ServerCmd( LUA->CheckString( 1 ) );
-	return 0;
-}
+	LUA->PushNumber( static_cast<double>( reordering::misses ) );
+	LUA->SetField( -2, "misses" );
 
-#endif
+	LUA->PushNumber( static_cast<double>( reordering::reorders ) );
+	LUA->SetField( -2, "reorders" );
+
+	LUA->PushNumber( reordering::depth_before );
+	LUA->SetField( -2, "depth_before" );
+
+	LUA->PushNumber( reordering::depth_after );
+	LUA->SetField( -2, "depth_after" );
+
+	return 1;
+}
 
 static void Initialize( GarrysMod::Lua::ILuaBase *LUA )
 {
@@ -393,12 +4319,94 @@ static void Initialize( GarrysMod::Lua::ILuaBase *LUA )
 	LUA->PushCFunction( GetAll );
 	LUA->SetField( -2, "GetAll" );
 
+	LUA->PushCFunction( Iterate );
+	LUA->SetField( -2, "Iterate" );
+
+	LUA->PushCFunction( GetByFlags );
+	LUA->SetField( -2, "GetByFlags" );
+
+	LUA->PushCFunction( CountByFlags );
+	LUA->SetField( -2, "CountByFlags" );
+
+	LUA->PushCFunction( SetFlagsBulk );
+	LUA->SetField( -2, "SetFlagsBulk" );
+
+	LUA->PushCFunction( UndoFlags );
+	LUA->SetField( -2, "UndoFlags" );
+
+	LUA->PushCFunction( FindByPrefix );
+	LUA->SetField( -2, "FindByPrefix" );
+
+	LUA->PushCFunction( Search );
+	LUA->SetField( -2, "Search" );
+
 	LUA->PushCFunction( Get );
 	LUA->SetField( -2, "Get" );
 
+	LUA->PushCFunction( Create );
+	LUA->SetField( -2, "Create" );
+
+	LUA->PushCFunction( SetProfiling );
+	LUA->SetField( -2, "SetProfiling" );
+
+	LUA->PushCFunction( GetProfile );
+	LUA->SetField( -2, "GetProfile" );
+
+	LUA->PushCFunction( ResetProfile );
+	LUA->SetField( -2, "ResetProfile" );
+
+#if defined CONCOMMANDX_SERVER
+
+	LUA->PushCFunction( SetRateLimit );
+	LUA->SetField( -2, "SetRateLimit" );
+
+	LUA->PushCFunction( GetRateLimits );
+	LUA->SetField( -2, "GetRateLimits" );
+
+	LUA->PushCFunction( ClearRateLimits );
+	LUA->SetField( -2, "ClearRateLimits" );
+
+	LUA->PushCFunction( SetPolicy );
+	LUA->SetField( -2, "SetPolicy" );
+
+	LUA->PushCFunction( GetPolicyHits );
+	LUA->SetField( -2, "GetPolicyHits" );
+
+	LUA->PushCFunction( CheckPolicy );
+	LUA->SetField( -2, "CheckPolicy" );
+
+#endif
+
 	LUA->PushCFunction( Execute );
 	LUA->SetField( -2, "Execute" );
 
+	LUA->PushCFunction( ExecuteBatch );
+	LUA->SetField( -2, "ExecuteBatch" );
+
+	LUA->PushCFunction( Schedule );
+	LUA->SetField( -2, "Schedule" );
+
+	LUA->PushCFunction( Cancel );
+	LUA->SetField( -2, "Cancel" );
+
+	LUA->PushCFunction( SetScheduleBudget );
+	LUA->SetField( -2, "SetScheduleBudget" );
+
+	LUA->PushCFunction( GetScheduleStats );
+	LUA->SetField( -2, "GetScheduleStats" );
+
+	LUA->PushCFunction( GetSubmissionStats );
+	LUA->SetField( -2, "GetSubmissionStats" );
+
+	LUA->PushCFunction( Capture );
+	LUA->SetField( -2, "Capture" );
+
+	LUA->PushCFunction( SetReordering );
+	LUA->SetField( -2, "SetReordering" );
+
+	LUA->PushCFunction( GetReorderingStats );
+	LUA->SetField( -2, "GetReorderingStats" );
+
 #if defined CONCOMMANDX_CLIENT
 
 	LUA->PushCFunction( ExecuteOnServer );
@@ -411,6 +4419,14 @@ static void Initialize( GarrysMod::Lua::ILuaBase *LUA )
 
 static void Deinitialize( GarrysMod::Lua::ILuaBase *LUA )
 {
+	if( snapshot_ref != -1 )
+	{
+		LUA->ReferenceFree( snapshot_ref );
+		snapshot_ref = -1;
+	}
+
+	flags_undo.clear( );
+
 	LUA->GetField( GarrysMod::Lua::INDEX_GLOBAL, "concommand" );
 
 	LUA->PushNil( );
@@ -419,12 +4435,94 @@ static void Deinitialize( GarrysMod::Lua::ILuaBase *LUA )
 	LUA->PushNil( );
 	LUA->SetField( -2, "GetAll" );
 
+	LUA->PushNil( );
+	LUA->SetField( -2, "Iterate" );
+
+	LUA->PushNil( );
+	LUA->SetField( -2, "GetByFlags" );
+
+	LUA->PushNil( );
+	LUA->SetField( -2, "CountByFlags" );
+
+	LUA->PushNil( );
+	LUA->SetField( -2, "SetFlagsBulk" );
+
+	LUA->PushNil( );
+	LUA->SetField( -2, "UndoFlags" );
+
+	LUA->PushNil( );
+	LUA->SetField( -2, "FindByPrefix" );
+
+	LUA->PushNil( );
+	LUA->SetField( -2, "Search" );
+
 	LUA->PushNil( );
 	LUA->SetField( -2, "Get" );
 
+	LUA->PushNil( );
+	LUA->SetField( -2, "Create" );
+
+	LUA->PushNil( );
+	LUA->SetField( -2, "SetProfiling" );
+
+	LUA->PushNil( );
+	LUA->SetField( -2, "GetProfile" );
+
+	LUA->PushNil( );
+	LUA->SetField( -2, "ResetProfile" );
+
+#if defined CONCOMMANDX_SERVER
+
+	LUA->PushNil( );
+	LUA->SetField( -2, "SetRateLimit" );
+
+	LUA->PushNil( );
+	LUA->SetField( -2, "GetRateLimits" );
+
+	LUA->PushNil( );
+	LUA->SetField( -2, "ClearRateLimits" );
+
+	LUA->PushNil( );
+	LUA->SetField( -2, "SetPolicy" );
+
+	LUA->PushNil( );
+	LUA->SetField( -2, "GetPolicyHits" );
+
+	LUA->PushNil( );
+	LUA->SetField( -2, "CheckPolicy" );
+
+#endif
+
 	LUA->PushNil( );
 	LUA->SetField( -2, "Execute" );
 
+	LUA->PushNil( );
+	LUA->SetField( -2, "ExecuteBatch" );
+
+	LUA->PushNil( );
+	LUA->SetField( -2, "Schedule" );
+
+	LUA->PushNil( );
+	LUA->SetField( -2, "Cancel" );
+
+	LUA->PushNil( );
+	LUA->SetField( -2, "SetScheduleBudget" );
+
+	LUA->PushNil( );
+	LUA->SetField( -2, "GetScheduleStats" );
+
+	LUA->PushNil( );
+	LUA->SetField( -2, "GetSubmissionStats" );
+
+	LUA->PushNil( );
+	LUA->SetField( -2, "Capture" );
+
+	LUA->PushNil( );
+	LUA->SetField( -2, "SetReordering" );
+
+	LUA->PushNil( );
+	LUA->SetField( -2, "GetReorderingStats" );
+
 #if defined CONCOMMANDX_CLIENT
 
 	LUA->PushNil( );
@@ -444,14 +4542,35 @@ namespace Player
 
 static const char *invalid_error = "Player object is not valid";
 
+// Entity userdata hold the entity's CBaseHandle (an EHANDLE) as their data,
+// GetUserType only returns nullptr for values of another type. The callers
+// still check the index against the engine's edicts.
 inline int32_t GetEntityIndex( GarrysMod::Lua::ILuaBase *LUA, int32_t i )
 {
-	LUA->Push( i );
-	LUA->GetField( -1, "EntIndex" );
-	LUA->Push( -2 );
-	LUA->Call( 1, 1 );
+	const CBaseHandle *handle = LUA->GetUserType<CBaseHandle>( i, GarrysMod::Lua::Type::ENTITY );
+	return handle != nullptr && handle->IsValid( ) ? handle->GetEntryIndex( ) : -1;
+}
+
+// Player slots span entity indices 1 to 128, gpGlobals isn't reachable from
+// here to know the actual maximum.
+static const int32_t max_players = 128;
+
+// Returns the edict of the player entity at the stack index, or nullptr for
+// anything that isn't a connected player.
+inline edict_t *GetPlayerEdict( GarrysMod::Lua::ILuaBase *LUA, int32_t i )
+{
+	if( !LUA->IsType( i, GarrysMod::Lua::Type::ENTITY ) )
+		return nullptr;
+
+	const int32_t index = GetEntityIndex( LUA, i );
+	if( index < 1 || index > max_players )
+		return nullptr;
 
-	return static_cast<int32_t>( LUA->GetNumber( -1 ) );
+	edict_t *edict = global::ivengine->PEntityOfEntIndex( index );
+	if( edict == nullptr || edict->IsFree( ) || global::ivengine->GetPlayerUserId( edict ) == -1 )
+		return nullptr;
+
+	return edict;
 }
 
 LUA_FUNCTION_STATIC( Command )
@@ -459,7 +4578,7 @@ LUA_FUNCTION_STATIC( Command )
 	LUA->CheckType( 1, GarrysMod::Lua::Type::ENTITY );
 	LUA->CheckType( 2, GarrysMod::Lua::Type::STRING );
 
-	edict_t *edict = global::ivengine->PEntityOfEntIndex( GetEntityIndex( LUA, 1 ) );
+	edict_t *edict = GetPlayerEdict( LUA, 1 );
 	if( edict == nullptr )
 		LUA->ThrowError( invalid_error );
 
@@ -467,6 +4586,110 @@ LUA_FUNCTION_STATIC( Command )
 	return 0;
 }
 
+inline int32_t CommandEdicts( edict_t **edicts, int32_t count, const char *command )
+{
+	for( int32_t k = 0; k < count; ++k )
+		global::ivengine->ClientCommand( edicts[k], "%s", command );
+
+	return count;
+}
+
+// player.CommandMany( players, command ) runs a command on a list of players
+// and returns on how many it was sent, skipping invalid entries.
+LUA_FUNCTION_STATIC( CommandMany )
+{
+	LUA->CheckType( 1, GarrysMod::Lua::Type::TABLE );
+	LUA->CheckType( 2, GarrysMod::Lua::Type::STRING );
+	const char *command = LUA->GetString( 2 );
+
+	edict_t *edicts[max_players];
+	bool queued[max_players + 1] = { false };
+	int32_t count = 0;
+	for( int32_t i = 1; count < max_players; ++i )
+	{
+		LUA->PushNumber( i );
+		LUA->GetTable( 1 );
+		if( LUA->IsType( -1, GarrysMod::Lua::Type::NIL ) )
+		{
+			LUA->Pop( 1 );
+			break;
+		}
+
+		edict_t *edict = GetPlayerEdict( LUA, -1 );
+		LUA->Pop( 1 );
+		if( edict == nullptr )
+			continue;
+
+		const int32_t index = global::ivengine->IndexOfEdict( edict );
+		if( !queued[index] )
+		{
+			queued[index] = true;
+			edicts[count++] = edict;
+		}
+	}
+
+	LUA->PushNumber( CommandEdicts( edicts, count, command ) );
+	return 1;
+}
+
+// player.CommandAll( command[, filter] ) runs a command on every connected
+// player, or on those for which filter( player ) returns true, and returns on
+// how many it was sent.
+LUA_FUNCTION_STATIC( CommandAll )
+{
+	LUA->CheckType( 1, GarrysMod::Lua::Type::STRING );
+	const char *command = LUA->GetString( 1 );
+
+	edict_t *edicts[max_players];
+	int32_t count = 0;
+	if( LUA->IsType( 2, GarrysMod::Lua::Type::NIL ) )
+	{
+		for( int32_t index = 1; index <= max_players; ++index )
+		{
+			edict_t *edict = global::ivengine->PEntityOfEntIndex( index );
+			if( edict != nullptr && !edict->IsFree( ) && global::ivengine->GetPlayerUserId( edict ) != -1 )
+				edicts[count++] = edict;
+		}
+
+		LUA->PushNumber( CommandEdicts( edicts, count, command ) );
+		return 1;
+	}
+
+	LUA->CheckType( 2, GarrysMod::Lua::Type::FUNCTION );
+
+	LUA->GetField( GarrysMod::Lua::INDEX_GLOBAL, "player" );
+	LUA->GetField( -1, "GetAll" );
+	LUA->Call( 0, 1 );
+	LUA->Remove( -2 );
+
+	for( int32_t i = 1; count < max_players; ++i )
+	{
+		LUA->PushNumber( i );
+		LUA->GetTable( -2 );
+		if( LUA->IsType( -1, GarrysMod::Lua::Type::NIL ) )
+		{
+			LUA->Pop( 1 );
+			break;
+		}
+
+		LUA->Push( 2 );
+		LUA->Push( -2 );
+		LUA->Call( 1, 1 );
+		const bool wanted = LUA->GetBool( -1 );
+		LUA->Pop( 1 );
+
+		edict_t *edict = wanted ? GetPlayerEdict( LUA, -1 ) : nullptr;
+		LUA->Pop( 1 );
+		if( edict != nullptr )
+			edicts[count++] = edict;
+	}
+
+	LUA->Pop( 1 );
+
+	LUA->PushNumber( CommandEdicts( edicts, count, command ) );
+	return 1;
+}
+
 static void Initialize( GarrysMod::Lua::ILuaBase *LUA )
 {
 	LUA->GetField( GarrysMod::Lua::INDEX_REGISTRY, "Player" );
@@ -475,6 +4698,16 @@ static void Initialize( GarrysMod::Lua::ILuaBase *LUA )
 	LUA->SetField( -2, "Command" );
 
 	LUA->Pop( 1 );
+
+	LUA->GetField( GarrysMod::Lua::INDEX_GLOBAL, "player" );
+
+	LUA->PushCFunction( CommandMany );
+	LUA->SetField( -2, "CommandMany" );
+
+	LUA->PushCFunction( CommandAll );
+	LUA->SetField( -2, "CommandAll" );
+
+	LUA->Pop( 1 );
 }
 
 static void Deinitialize( GarrysMod::Lua::ILuaBase *LUA )
@@ -485,6 +4718,16 @@ static void Deinitialize( GarrysMod::Lua::ILuaBase *LUA )
 	LUA->SetField( -2, "Command" );
 
 	LUA->Pop( 1 );
+
+	LUA->GetField( GarrysMod::Lua::INDEX_GLOBAL, "player" );
+
+	LUA->PushNil( );
+	LUA->SetField( -2, "CommandMany" );
+
+	LUA->PushNil( );
+	LUA->SetField( -2, "CommandAll" );
+
+	LUA->Pop( 1 );
 }
 
 }
@@ -494,12 +4737,17 @@ static void Deinitialize( GarrysMod::Lua::ILuaBase *LUA )
 GMOD_MODULE_OPEN( )
 {
 	global::Initialize( LUA );
+	cvarhooks::Initialize( );
 	concommands::Initialize( LUA );
 	concommand::Initialize( LUA );
+	arguments::Initialize( LUA );
+	scheduler::Initialize( LUA );
+	submissions::Initialize( );
 
 #if defined CONCOMMANDX_SERVER
 
 	Player::Initialize( LUA );
+	clients::Initialize( );
 
 #endif
 
@@ -512,10 +4760,29 @@ GMOD_MODULE_CLOSE( )
 #if defined CONCOMMANDX_SERVER
 
 	Player::Deinitialize( LUA );
+	clients::Deinitialize( );
 
 #endif
 
+	submissions::Deinitialize( );
+	scheduler::Deinitialize( LUA );
 	concommands::Deinitialize( LUA );
 	concommand::Deinitialize( LUA );
+
+#if defined CONCOMMANDX_SERVER
+
+	ratelimit::Deinitialize( );
+	policy::Deinitialize( );
+
+#endif
+
+	interceptors::Deinitialize( );
+	handlers::Deinitialize( LUA );
+	arguments::Deinitialize( LUA );
+	search::Deinitialize( );
+	registry::Deinitialize( );
+	reordering::Deinitialize( );
+	cvarhooks::Deinitialize( );
+	strings::Deinitialize( );
 	return 0;
 }
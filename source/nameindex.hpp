@@ -0,0 +1,158 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Case-insensitive open addressing index from names to commands (anything with
+// an m_pszName), with linear probing and backward shift deletion. A name maps
+// to the first command indexed under it, so indexing a list in order finds
+// what a walk of it would. The table is kept at most half full.
+template<typename Command>
+class NameIndex
+{
+public:
+	NameIndex( ) :
+		used( 0 )
+	{ }
+
+	static uint8_t ToLower( uint8_t c )
+	{
+		return c >= 'A' && c <= 'Z' ? static_cast<uint8_t>( c - 'A' + 'a' ) : c;
+	}
+
+	static uint32_t Hash( const char *name )
+	{
+		uint32_t hash = 2166136261u;
+		for( ; *name != '\0'; ++name )
+		{
+			hash ^= ToLower( static_cast<uint8_t>( *name ) );
+			hash *= 16777619u;
+		}
+
+		return hash;
+	}
+
+	static bool Equal( const char *a, const char *b )
+	{
+		for( ; ToLower( static_cast<uint8_t>( *a ) ) == ToLower( static_cast<uint8_t>( *b ) ); ++a, ++b )
+			if( *a == '\0' )
+				return true;
+
+		return false;
+	}
+
+	void Rebuild( const std::vector<Command *> &commands )
+	{
+		size_t capacity = 16;
+		while( capacity < commands.size( ) * 2 )
+			capacity <<= 1;
+
+		Entry empty = { 0, nullptr };
+		entries.assign( capacity, empty );
+		used = 0;
+		for( size_t k = 0; k < commands.size( ); ++k )
+			Place( commands[k], Hash( commands[k]->m_pszName ) );
+	}
+
+	Command *Find( const char *name ) const
+	{
+		if( used == 0 )
+			return nullptr;
+
+		const uint32_t hash = Hash( name );
+		const size_t mask = entries.size( ) - 1;
+		for( size_t k = hash & mask; entries[k].command != nullptr; k = ( k + 1 ) & mask )
+		{
+			const Entry &entry = entries[k];
+			if( entry.hash == hash && Equal( entry.command->m_pszName, name ) )
+				return entry.command;
+		}
+
+		return nullptr;
+	}
+
+	// Indexes the command under its current name, unless another one already
+	// is.
+	void Insert( Command *command )
+	{
+		if( ( used + 1 ) * 2 > entries.size( ) )
+			Grow( );
+
+		Place( command, Hash( command->m_pszName ) );
+	}
+
+	// Drops the command, which must still have the name it was indexed under.
+	// Returns whether it was the one indexed under that name.
+	bool Erase( Command *command )
+	{
+		if( used == 0 )
+			return false;
+
+		const size_t mask = entries.size( ) - 1;
+		size_t k = Hash( command->m_pszName ) & mask;
+		while( entries[k].command != command )
+		{
+			if( entries[k].command == nullptr )
+				return false;
+
+			k = ( k + 1 ) & mask;
+		}
+
+		for( size_t next = ( k + 1 ) & mask; entries[next].command != nullptr; next = ( next + 1 ) & mask )
+		{
+			const size_t home = entries[next].hash & mask;
+			if( ( ( next - home ) & mask ) >= ( ( next - k ) & mask ) )
+			{
+				entries[k] = entries[next];
+				k = next;
+			}
+		}
+
+		entries[k].command = nullptr;
+		--used;
+		return true;
+	}
+
+	void Clear( )
+	{
+		std::vector<Entry>( ).swap( entries );
+		used = 0;
+	}
+
+private:
+	struct Entry
+	{
+		uint32_t hash;
+		Command *command;
+	};
+
+	void Place( Command *command, uint32_t hash )
+	{
+		const size_t mask = entries.size( ) - 1;
+		size_t k = hash & mask;
+		for( ; entries[k].command != nullptr; k = ( k + 1 ) & mask )
+			if( entries[k].hash == hash && Equal( entries[k].command->m_pszName, command->m_pszName ) )
+				return;
+
+		entries[k].hash = hash;
+		entries[k].command = command;
+		++used;
+	}
+
+	void Grow( )
+	{
+		std::vector<Entry> old;
+		old.swap( entries );
+
+		Entry empty = { 0, nullptr };
+		entries.assign( old.empty( ) ? 16 : old.size( ) * 2, empty );
+		used = 0;
+		for( size_t k = 0; k < old.size( ); ++k )
+			if( old[k].command != nullptr )
+				Place( old[k].command, old[k].hash );
+	}
+
+	std::vector<Entry> entries;
+	size_t used;
+};
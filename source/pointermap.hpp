@@ -0,0 +1,139 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Open addressing map keyed by pointers, with linear probing and backward
+// shift deletion so no tombstones are left behind.
+template<typename Value>
+class PointerMap
+{
+public:
+	PointerMap( ) :
+		count( 0 ),
+		shift( 64 )
+	{ }
+
+	size_t Size( ) const
+	{
+		return count;
+	}
+
+	Value *Find( const void *key )
+	{
+		if( count == 0 )
+			return nullptr;
+
+		const size_t mask = slots.size( ) - 1;
+		for( size_t k = Home( key ); slots[k].key != nullptr; k = ( k + 1 ) & mask )
+			if( slots[k].key == key )
+				return &slots[k].value;
+
+		return nullptr;
+	}
+
+	Value &Insert( const void *key, const Value &value )
+	{
+		Value *existing = Find( key );
+		if( existing != nullptr )
+			return *existing = value;
+
+		if( ( count + 1 ) * 2 > slots.size( ) )
+			Grow( );
+
+		++count;
+		return Place( key, value );
+	}
+
+	bool Erase( const void *key )
+	{
+		if( count == 0 )
+			return false;
+
+		const size_t mask = slots.size( ) - 1;
+		size_t k = Home( key );
+		while( slots[k].key != key )
+		{
+			if( slots[k].key == nullptr )
+				return false;
+
+			k = ( k + 1 ) & mask;
+		}
+
+		for( size_t next = ( k + 1 ) & mask; slots[next].key != nullptr; next = ( next + 1 ) & mask )
+		{
+			const size_t home = Home( slots[next].key );
+			if( ( ( next - home ) & mask ) >= ( ( next - k ) & mask ) )
+			{
+				slots[k] = slots[next];
+				k = next;
+			}
+		}
+
+		slots[k].key = nullptr;
+		slots[k].value = Value( );
+		--count;
+		return true;
+	}
+
+	void Clear( )
+	{
+		std::vector<Slot>( ).swap( slots );
+		count = 0;
+		shift = 64;
+	}
+
+	template<typename Function>
+	void ForEach( Function function )
+	{
+		for( size_t k = 0; k < slots.size( ); ++k )
+			if( slots[k].key != nullptr )
+				function( slots[k].key, slots[k].value );
+	}
+
+private:
+	struct Slot
+	{
+		const void *key;
+		Value value;
+	};
+
+	// Fibonacci hashing, the top bits of the 64-bit product depend on every
+	// bit of the pointer, unlike the low ones which ignore the high bits
+	size_t Home( const void *key ) const
+	{
+		const uint64_t k = static_cast<uint64_t>( reinterpret_cast<uintptr_t>( key ) );
+		return static_cast<size_t>( ( k * 11400714819323198485ull ) >> shift );
+	}
+
+	Value &Place( const void *key, const Value &value )
+	{
+		const size_t mask = slots.size( ) - 1;
+		size_t k = Home( key );
+		while( slots[k].key != nullptr )
+			k = ( k + 1 ) & mask;
+
+		slots[k].key = key;
+		slots[k].value = value;
+		return slots[k].value;
+	}
+
+	void Grow( )
+	{
+		std::vector<Slot> old;
+		old.swap( slots );
+
+		Slot empty = { nullptr, Value( ) };
+		slots.assign( old.empty( ) ? 16 : old.size( ) * 2, empty );
+		shift = old.empty( ) ? 60 : shift - 1;
+		for( size_t k = 0; k < old.size( ); ++k )
+			if( old[k].key != nullptr )
+				Place( old[k].key, old[k].value );
+	}
+
+	std::vector<Slot> slots;
+	size_t count;
+	// 64 - log2 of the slot count
+	uint32_t shift;
+};
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// Trigram index over documents made of a name and a help text, searched
+// case-insensitively. Documents are numbered in the order they're added and
+// their texts are only pointed to, so they must outlive the index (or the next
+// Clear).
+// Postings hold ( id << 1 ) | field, where field 0 is the name and 1 the help.
+class TrigramIndex
+{
+public:
+	struct Match
+	{
+		uint32_t id;
+		uint32_t matched;
+		uint32_t name_matched;
+	};
+
+	void Clear( )
+	{
+		postings.clear( );
+		names.clear( );
+		helps.clear( );
+	}
+
+	// Either text may be null.
+	void Add( const char *name, const char *help )
+	{
+		const uint32_t id = static_cast<uint32_t>( names.size( ) );
+		names.push_back( name );
+		helps.push_back( help );
+		AddText( name, id << 1 );
+		AddText( help, id << 1 | 1 );
+	}
+
+	size_t Size( ) const
+	{
+		return names.size( );
+	}
+
+	// Finds documents by how many distinct query trigrams they contain, and how
+	// many of those are in the name. At least half of the trigrams must be
+	// found. Queries too short to have trigrams match as substrings instead.
+	// Matches come out in document order.
+	void Query( const char *query, std::vector<Match> &matches ) const
+	{
+		matches.clear( );
+
+		std::vector<uint32_t> trigrams;
+		for( const char *text = query; text[0] != '\0' && text[1] != '\0' && text[2] != '\0'; ++text )
+			trigrams.push_back( Trigram( text ) );
+
+		std::sort( trigrams.begin( ), trigrams.end( ) );
+		trigrams.erase( std::unique( trigrams.begin( ), trigrams.end( ) ), trigrams.end( ) );
+
+		if( trigrams.empty( ) )
+		{
+			for( size_t id = 0; id < names.size( ); ++id )
+			{
+				const bool name = Contains( names[id], query );
+				if( name || Contains( helps[id], query ) )
+				{
+					Match match = { static_cast<uint32_t>( id ), 1, name ? 1u : 0u };
+					matches.push_back( match );
+				}
+			}
+
+			return;
+		}
+
+		std::vector<uint32_t> matched( names.size( ), 0 ), name_matched( names.size( ), 0 );
+		std::vector<uint32_t> last( names.size( ), 0 );
+		for( size_t t = 0; t < trigrams.size( ); ++t )
+		{
+			std::unordered_map<uint32_t, std::vector<uint32_t>>::const_iterator it = postings.find( trigrams[t] );
+			if( it == postings.end( ) )
+				continue;
+
+			const std::vector<uint32_t> &list = it->second;
+			for( size_t k = 0; k < list.size( ); ++k )
+			{
+				const uint32_t id = list[k] >> 1;
+				if( last[id] != t + 1 )
+				{
+					last[id] = static_cast<uint32_t>( t + 1 );
+					++matched[id];
+				}
+
+				if( ( list[k] & 1 ) == 0 )
+					++name_matched[id];
+			}
+		}
+
+		const uint32_t threshold = static_cast<uint32_t>( ( trigrams.size( ) + 1 ) / 2 );
+		for( size_t id = 0; id < names.size( ); ++id )
+			if( matched[id] >= threshold )
+			{
+				Match match = { static_cast<uint32_t>( id ), matched[id], name_matched[id] };
+				matches.push_back( match );
+			}
+	}
+
+private:
+	static uint8_t ToLower( uint8_t c )
+	{
+		return c >= 'A' && c <= 'Z' ? static_cast<uint8_t>( c - 'A' + 'a' ) : c;
+	}
+
+	static uint32_t Trigram( const char *text )
+	{
+		return static_cast<uint32_t>( ToLower( static_cast<uint8_t>( text[0] ) ) ) << 16 |
+			static_cast<uint32_t>( ToLower( static_cast<uint8_t>( text[1] ) ) ) << 8 |
+			ToLower( static_cast<uint8_t>( text[2] ) );
+	}
+
+	// Case-insensitive substring test, for queries too short to have trigrams.
+	static bool Contains( const char *text, const char *query )
+	{
+		if( text == nullptr )
+			return false;
+
+		for( ; *text != '\0'; ++text )
+		{
+			const char *a = text, *b = query;
+			for( ; *b != '\0' && ToLower( static_cast<uint8_t>( *a ) ) == ToLower( static_cast<uint8_t>( *b ) ); ++a, ++b )
+				;
+
+			if( *b == '\0' )
+				return true;
+		}
+
+		return false;
+	}
+
+	void AddText( const char *text, uint32_t posting )
+	{
+		if( text == nullptr )
+			return;
+
+		for( ; text[0] != '\0' && text[1] != '\0' && text[2] != '\0'; ++text )
+		{
+			std::vector<uint32_t> &list = postings[Trigram( text )];
+			if( list.empty( ) || list.back( ) != posting )
+				list.push_back( posting );
+		}
+	}
+
+	std::unordered_map<uint32_t, std::vector<uint32_t>> postings;
+	std::vector<const char *> names;
+	std::vector<const char *> helps;
+};
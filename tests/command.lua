@@ -0,0 +1,37 @@
+-- Benchmark of Player:Command, which reads the entity index straight from the
+-- entity userdata. It needs the game: install the module, copy this file to
+-- garrysmod/lua and run "lua_openscript command.lua" on a server with a free
+-- player slot for a bot (commands sent to bots go nowhere).
+-- Before, every Player:Command looked up EntIndex on the entity and called it
+-- through the Lua API. That code is gone, so the cost of calling EntIndex from
+-- Lua is printed next to it, as a close lower bound of what it added.
+
+require("concommandx")
+
+local calls = 200000
+
+local function Time(fn)
+	local start = SysTime()
+	for i = 1, calls do
+		fn()
+	end
+
+	return (SysTime() - start) / calls * 1e9
+end
+
+local bot = player.CreateNextBot("concommandx_bench")
+assert(IsValid(bot), "couldn't create a bot, is there a free player slot?")
+
+local sum = 0
+local command_time = Time(function()
+	bot:Command("")
+end)
+local entindex_time = Time(function()
+	sum = sum + bot:EntIndex()
+end)
+assert(sum == bot:EntIndex() * calls)
+
+print(string.format("Player:Command %.0f ns per call, Entity:EntIndex %.0f ns per call",
+	command_time, entindex_time))
+
+bot:Kick("benchmark done")
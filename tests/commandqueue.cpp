@@ -0,0 +1,228 @@
+// Stress test for the queue behind ConCommandX_Submit. Standalone, build with
+//   c++ -std=c++11 -O2 -pthread -I../source commandqueue.cpp -o commandqueue
+// (adding -fsanitize=thread is worth it) and run it, it exits non-zero and
+// says why on failure.
+
+#include <commandqueue.hpp>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+static const size_t capacity = 64;
+static const size_t max_length = 512;
+static const size_t producers = 8;
+static const size_t per_producer = 100000;
+
+typedef CommandQueue<capacity, max_length> Queue;
+
+static int failures = 0;
+
+#define CHECK( condition ) \
+	do \
+	{ \
+		if( !( condition ) ) \
+		{ \
+			std::fprintf( stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition ); \
+			++failures; \
+		} \
+	} \
+	while( false )
+
+// Stands in for IVEngineServer, records what ServerCommand receives by
+// producer and sequence number ("p<producer> <sequence>\n").
+class MockEngine
+{
+public:
+	MockEngine( ) :
+		received( producers, std::vector<uint8_t>( per_producer, 0 ) ),
+		last( producers, -1 ),
+		total( 0 ),
+		malformed( 0 ),
+		duplicated( 0 ),
+		reordered( 0 )
+	{ }
+
+	void ServerCommand( const char *command )
+	{
+		unsigned long producer = 0, sequence = 0;
+		char newline = '\0';
+		if( std::sscanf( command, "p%lu %lu%c", &producer, &sequence, &newline ) != 3 ||
+			newline != '\n' || producer >= producers || sequence >= per_producer )
+		{
+			++malformed;
+			return;
+		}
+
+		++total;
+		if( received[producer][sequence]++ != 0 )
+			++duplicated;
+
+		// one producer's commands must come out in the order it pushed them
+		if( static_cast<long>( sequence ) <= last[producer] )
+			++reordered;
+
+		last[producer] = static_cast<long>( sequence );
+	}
+
+	std::vector<std::vector<uint8_t>> received;
+	std::vector<long> last;
+	size_t total;
+	size_t malformed;
+	size_t duplicated;
+	size_t reordered;
+};
+
+static size_t Drain( Queue &queue, MockEngine &engine )
+{
+	return queue.Drain( [&engine]( const char *command )
+	{
+		engine.ServerCommand( command );
+	} );
+}
+
+static std::string Command( size_t producer, size_t sequence )
+{
+	char buffer[64];
+	std::snprintf( buffer, sizeof( buffer ), "p%lu %lu",
+		static_cast<unsigned long>( producer ), static_cast<unsigned long>( sequence ) );
+	return buffer;
+}
+
+// Without a consumer, exactly capacity pushes fit and every other one is
+// dropped and counted, as are commands too long and pushes to a closed queue.
+static void TestFull( )
+{
+	Queue *queue = new Queue;
+	queue->Open( );
+
+	const size_t extra = 37;
+	size_t accepted = 0;
+	for( size_t k = 0; k < capacity + extra; ++k )
+		if( queue->Push( Command( 0, k ).c_str( ) ) )
+			++accepted;
+
+	CHECK( accepted == capacity );
+	CHECK( queue->Submitted( ) == capacity );
+	CHECK( queue->Dropped( ) == extra );
+
+	// the line break and terminator need two more bytes
+	const std::string longest( max_length - 2, 'x' ), too_long( max_length - 1, 'x' );
+	CHECK( !queue->Push( too_long.c_str( ) ) );
+	CHECK( queue->Dropped( ) == extra + 1 );
+
+	MockEngine engine;
+	CHECK( Drain( *queue, engine ) == capacity );
+	CHECK( engine.total == capacity && engine.duplicated == 0 && engine.reordered == 0 );
+	for( size_t k = 0; k < capacity; ++k )
+		CHECK( engine.received[0][k] == 1 );
+
+	size_t lines = 0;
+	CHECK( queue->Push( longest.c_str( ) ) );
+	queue->Drain( [&lines, &longest]( const char *command )
+	{
+		CHECK( command == longest + '\n' );
+		++lines;
+	} );
+	CHECK( lines == 1 );
+
+	queue->Close( );
+	CHECK( !queue->Push( "p0 0" ) );
+	CHECK( queue->Dropped( ) == extra + 2 );
+
+	delete queue;
+}
+
+// Producers push while the consumer drains, either giving up on a command
+// when the queue is full or retrying it: every accepted command comes out
+// exactly once and in order, and every failed push is counted as dropped.
+static void TestConcurrent( bool retry )
+{
+	Queue *queue = new Queue;
+	queue->Open( );
+
+	MockEngine engine;
+	std::atomic<size_t> running( producers );
+	std::vector<size_t> accepted( producers, 0 ), calls( producers, 0 );
+	std::vector<std::thread> threads;
+	for( size_t p = 0; p < producers; ++p )
+		threads.push_back( std::thread( [p, retry, queue, &accepted, &calls, &running]( )
+		{
+			for( size_t k = 0; k < per_producer; ++k )
+			{
+				const std::string command = Command( p, k );
+				for( ; ; )
+				{
+					++calls[p];
+					if( queue->Push( command.c_str( ) ) )
+					{
+						++accepted[p];
+						break;
+					}
+
+					if( !retry )
+						break;
+
+					std::this_thread::yield( );
+				}
+			}
+
+			running.fetch_sub( 1, std::memory_order_release );
+		} ) );
+
+	while( running.load( std::memory_order_acquire ) != 0 )
+		if( Drain( *queue, engine ) == 0 )
+			std::this_thread::yield( );
+
+	for( size_t p = 0; p < producers; ++p )
+		threads[p].join( );
+
+	while( Drain( *queue, engine ) != 0 )
+		;
+
+	size_t pushed = 0, attempts = 0;
+	for( size_t p = 0; p < producers; ++p )
+	{
+		pushed += accepted[p];
+		attempts += calls[p];
+	}
+
+	CHECK( engine.malformed == 0 );
+	CHECK( engine.duplicated == 0 );
+	CHECK( engine.reordered == 0 );
+	CHECK( engine.total == pushed );
+	CHECK( queue->Submitted( ) == pushed );
+	CHECK( queue->Dropped( ) == attempts - pushed );
+	if( retry )
+	{
+		CHECK( pushed == producers * per_producer );
+		for( size_t p = 0; p < producers; ++p )
+			for( size_t k = 0; k < per_producer; ++k )
+				CHECK( engine.received[p][k] == 1 );
+	}
+
+	std::printf( "%s: %lu submitted, %lu dropped\n", retry ? "retrying" : "dropping",
+		static_cast<unsigned long>( queue->Submitted( ) ),
+		static_cast<unsigned long>( queue->Dropped( ) ) );
+
+	delete queue;
+}
+
+int main( )
+{
+	TestFull( );
+	TestConcurrent( false );
+	TestConcurrent( true );
+
+	if( failures != 0 )
+	{
+		std::fprintf( stderr, "%d checks failed\n", failures );
+		return EXIT_FAILURE;
+	}
+
+	std::printf( "all checks passed\n" );
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,42 @@
+-- Benchmark of commands registered with concommand.Create against the same
+-- command registered with concommand.Add. It needs the game: install the
+-- module, copy this file to garrysmod/lua and run "lua_openscript create.lua"
+-- on a server (or "lua_openscript_cl create.lua" on a client).
+-- Both commands are run through concommand:Dispatch, which calls the
+-- ConCommand's Dispatch like the engine does when it executes a line, so the
+-- difference is what happens from there to the Lua function.
+
+require("concommandx")
+
+local calls = 200000
+
+local function Time(command, ...)
+	local start = SysTime()
+	for i = 1, calls do
+		command:Dispatch(...)
+	end
+
+	return (SysTime() - start) / calls * 1e9
+end
+
+local stock_count, native_count = 0, 0
+concommand.Add("concommandx_bench_stock", function(ply, cmd, args, argstr)
+	stock_count = stock_count + 1
+end)
+local stock = concommand.Get("concommandx_bench_stock")
+local native = concommand.Create("concommandx_bench_native", "", 0, function(args)
+	native_count = native_count + 1
+end)
+
+for _, arguments in ipairs({{}, {"one", "two", "three"}}) do
+	stock_count, native_count = 0, 0
+	local stock_time = Time(stock, unpack(arguments))
+	local native_time = Time(native, unpack(arguments))
+	assert(stock_count == calls and native_count == calls, "not every dispatch reached its function")
+
+	print(string.format("%d arguments: concommand.Add %.0f ns, concommand.Create %.0f ns per call",
+		#arguments, stock_time, native_time))
+end
+
+concommand.Remove("concommandx_bench_stock")
+native:Remove()
@@ -0,0 +1,235 @@
+// Tests for the glob DFA behind concommand.SetPolicy. Standalone, build with
+//   c++ -std=c++11 -O2 -I../source globautomaton.cpp -o globautomaton
+// and run it, it exits non-zero and says why on failure.
+
+#include <globautomaton.hpp>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+static int failures = 0;
+
+#define CHECK( condition ) \
+	do \
+	{ \
+		if( !( condition ) ) \
+		{ \
+			std::fprintf( stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition ); \
+			++failures; \
+		} \
+	} \
+	while( false )
+
+static const uint32_t none = GlobAutomaton::no_match;
+
+static char Lower( char c )
+{
+	return c >= 'A' && c <= 'Z' ? static_cast<char>( c - 'A' + 'a' ) : c;
+}
+
+// Backtracking matcher the DFA must agree with.
+static bool GlobMatch( const char *pattern, const char *name )
+{
+	if( *pattern == '\0' )
+		return *name == '\0';
+
+	if( *pattern == '*' )
+		return GlobMatch( pattern + 1, name ) || ( *name != '\0' && GlobMatch( pattern, name + 1 ) );
+
+	return *name != '\0' && ( *pattern == '?' || Lower( *pattern ) == Lower( *name ) ) &&
+		GlobMatch( pattern + 1, name + 1 );
+}
+
+static uint32_t FirstMatch( const std::vector<std::string> &patterns, const std::string &name )
+{
+	for( size_t k = 0; k < patterns.size( ); ++k )
+		if( GlobMatch( patterns[k].c_str( ), name.c_str( ) ) )
+			return static_cast<uint32_t>( k );
+
+	return none;
+}
+
+static void TestEmpty( )
+{
+	GlobAutomaton automaton( 16384 );
+	CHECK( automaton.Match( "say" ) == none );
+	CHECK( automaton.Match( "" ) == none );
+
+	const std::vector<std::string> patterns( 1, "say" );
+	CHECK( automaton.Compile( patterns ) );
+	CHECK( automaton.Match( "say" ) == 0 );
+
+	// compiling no patterns again matches nothing, not even the empty name
+	CHECK( automaton.Compile( std::vector<std::string>( ) ) );
+	CHECK( automaton.Match( "say" ) == none );
+	CHECK( automaton.Match( "" ) == none );
+
+	// an empty pattern only matches the empty name
+	CHECK( automaton.Compile( std::vector<std::string>( 1, "" ) ) );
+	CHECK( automaton.Match( "" ) == 0 );
+	CHECK( automaton.Match( "a" ) == none );
+}
+
+static void TestPrecedence( )
+{
+	GlobAutomaton automaton( 16384 );
+	std::vector<std::string> patterns;
+	patterns.push_back( "sv_cheats" );
+	patterns.push_back( "sv_*" );
+	patterns.push_back( "*" );
+	CHECK( automaton.Compile( patterns ) );
+	CHECK( automaton.Match( "sv_cheats" ) == 0 );
+	CHECK( automaton.Match( "sv_cheat" ) == 1 );
+	CHECK( automaton.Match( "sv_" ) == 1 );
+	CHECK( automaton.Match( "say" ) == 2 );
+	CHECK( automaton.Match( "" ) == 2 );
+
+	// a broader pattern first shadows the later ones
+	std::swap( patterns[0], patterns[2] );
+	CHECK( automaton.Compile( patterns ) );
+	CHECK( automaton.Match( "sv_cheats" ) == 0 );
+	CHECK( automaton.Match( "say" ) == 0 );
+}
+
+static void TestWildcards( )
+{
+	GlobAutomaton automaton( 16384 );
+	std::vector<std::string> patterns;
+	patterns.push_back( "a*b*c" );
+	patterns.push_back( "??" );
+	patterns.push_back( "x?*?y" );
+	patterns.push_back( "*?" );
+	CHECK( automaton.Compile( patterns ) );
+	CHECK( automaton.Match( "abc" ) == 0 );
+	CHECK( automaton.Match( "aXXbYYc" ) == 0 );
+	CHECK( automaton.Match( "abcbc" ) == 0 );
+	CHECK( automaton.Match( "abcb" ) == 3 );
+	CHECK( automaton.Match( "zz" ) == 1 );
+	CHECK( automaton.Match( "xy" ) == 1 );
+	CHECK( automaton.Match( "x1y" ) == 3 );
+	CHECK( automaton.Match( "x12y" ) == 2 );
+	CHECK( automaton.Match( "x1234y" ) == 2 );
+	CHECK( automaton.Match( "z" ) == 3 );
+	CHECK( automaton.Match( "" ) == none );
+
+	// bytes no pattern mentions only go through wildcards
+	CHECK( automaton.Compile( std::vector<std::string>( 1, "a?c" ) ) );
+	CHECK( automaton.Match( "a\xff" "c" ) == 0 );
+	CHECK( automaton.Match( "\xff" "bc" ) == none );
+}
+
+static void TestCollapsedStars( )
+{
+	GlobAutomaton single( 16384 ), collapsed( 16384 );
+	CHECK( single.Compile( std::vector<std::string>( 1, "a*b" ) ) );
+	CHECK( collapsed.Compile( std::vector<std::string>( 1, "a***b" ) ) );
+	CHECK( single.States( ) == collapsed.States( ) );
+
+	const char *names[] = { "ab", "axb", "axxb", "abb", "a", "b", "ba", "" };
+	for( size_t k = 0; k < sizeof( names ) / sizeof( *names ); ++k )
+		CHECK( single.Match( names[k] ) == collapsed.Match( names[k] ) );
+
+	CHECK( collapsed.Compile( std::vector<std::string>( 1, "**" ) ) );
+	CHECK( collapsed.Match( "" ) == 0 );
+	CHECK( collapsed.Match( "anything" ) == 0 );
+}
+
+static void TestCase( )
+{
+	GlobAutomaton automaton( 16384 );
+	std::vector<std::string> patterns;
+	patterns.push_back( "SV_Cheats" );
+	patterns.push_back( "kick?D" );
+	CHECK( automaton.Compile( patterns ) );
+	CHECK( automaton.Match( "sv_cheats" ) == 0 );
+	CHECK( automaton.Match( "SV_CHEATS" ) == 0 );
+	CHECK( automaton.Match( "sV_cHeAtS" ) == 0 );
+	CHECK( automaton.Match( "KICKid" ) == 1 );
+	CHECK( automaton.Match( "kick_d" ) == 1 );
+	// only ASCII letters fold, punctuation next to them doesn't
+	CHECK( automaton.Match( "sv-cheats" ) == none );
+}
+
+static void TestLimit( )
+{
+	// "*a?????" has to remember which of the last six characters were an 'a',
+	// which takes more states than the limit
+	std::vector<std::string> patterns( 1, "*a?????" );
+	GlobAutomaton unlimited( 16384 );
+	CHECK( unlimited.Compile( patterns ) );
+	CHECK( unlimited.States( ) > 32 );
+
+	GlobAutomaton limited( 32 );
+	const std::vector<std::string> previous( 1, "say" );
+	CHECK( limited.Compile( previous ) );
+	CHECK( !limited.Compile( patterns ) );
+	// a failed compile keeps the previous patterns
+	CHECK( limited.Match( "say" ) == 0 );
+	CHECK( limited.Match( "xaxxxxx" ) == none );
+
+	GlobAutomaton exact( unlimited.States( ) );
+	CHECK( exact.Compile( patterns ) );
+	GlobAutomaton short_one( unlimited.States( ) - 1 );
+	CHECK( !short_one.Compile( patterns ) );
+}
+
+// Random patterns and names over a small alphabet, checked against the
+// backtracking matcher.
+static void TestRandom( )
+{
+	const char pattern_alphabet[] = "abAB?*";
+	const char name_alphabet[] = "abABc";
+	std::mt19937 random( 12345 );
+	GlobAutomaton automaton( 16384 );
+	for( size_t round = 0; round < 2000; ++round )
+	{
+		std::vector<std::string> patterns( 1 + random( ) % 4 );
+		for( size_t p = 0; p < patterns.size( ); ++p )
+		{
+			const size_t length = random( ) % 6;
+			for( size_t k = 0; k < length; ++k )
+				patterns[p] += pattern_alphabet[random( ) % ( sizeof( pattern_alphabet ) - 1 )];
+		}
+
+		CHECK( automaton.Compile( patterns ) );
+		for( size_t n = 0; n < 50; ++n )
+		{
+			std::string name;
+			const size_t length = random( ) % 8;
+			for( size_t k = 0; k < length; ++k )
+				name += name_alphabet[random( ) % ( sizeof( name_alphabet ) - 1 )];
+
+			const uint32_t expected = FirstMatch( patterns, name );
+			if( automaton.Match( name.c_str( ) ) != expected )
+			{
+				std::fprintf( stderr, "\"%s\" against \"%s\"...: expected %u\n",
+					name.c_str( ), patterns[0].c_str( ), expected );
+				++failures;
+			}
+		}
+	}
+}
+
+int main( )
+{
+	TestEmpty( );
+	TestPrecedence( );
+	TestWildcards( );
+	TestCollapsedStars( );
+	TestCase( );
+	TestLimit( );
+	TestRandom( );
+
+	if( failures != 0 )
+	{
+		std::fprintf( stderr, "%d checks failed\n", failures );
+		return EXIT_FAILURE;
+	}
+
+	std::printf( "all checks passed\n" );
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,142 @@
+// Tests and benchmark for the handles concommand objects hold. Standalone,
+// build with
+//   c++ -std=c++11 -O2 -I../source handletable.cpp -o handletable
+// and run it, it exits non-zero and says why on failure, then prints what
+// validating a handle costs over reading a raw pointer, which is what
+// concommand::Get did before.
+
+#include <handletable.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+static int failures = 0;
+
+#define CHECK( condition ) \
+	do \
+	{ \
+		if( !( condition ) ) \
+		{ \
+			std::fprintf( stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition ); \
+			++failures; \
+		} \
+	} \
+	while( false )
+
+// Stands in for a ConCommand, with the field a method would read.
+struct Object
+{
+	const char *name;
+	char rest[80];
+};
+
+typedef HandleTable<Object> Table;
+
+static void TestLifetime( )
+{
+	Object a = { "a", { } }, b = { "b", { } };
+	Table table;
+
+	const Table::Handle first = table.Acquire( &a );
+	CHECK( table.Resolve( first ) == &a );
+
+	// acquiring again hands out the same slot and generation
+	const Table::Handle again = table.Acquire( &a );
+	CHECK( again.slot == first.slot && again.generation == first.generation );
+
+	table.Release( &a );
+	CHECK( table.Resolve( first ) == nullptr );
+	table.Release( &a );
+
+	// the slot is reused, old handles to it stay stale
+	const Table::Handle second = table.Acquire( &b );
+	CHECK( second.slot == first.slot && second.generation != first.generation );
+	CHECK( table.Resolve( second ) == &b );
+	CHECK( table.Resolve( first ) == nullptr );
+
+	// the same address coming back is a new object as far as handles go
+	const Table::Handle third = table.Acquire( &a );
+	CHECK( third.slot != second.slot && table.Resolve( third ) == &a );
+	CHECK( table.Resolve( first ) == nullptr );
+
+	Table::Handle bogus = { 1000, 1 };
+	CHECK( table.Resolve( bogus ) == nullptr );
+
+	table.Clear( );
+	CHECK( table.Resolve( second ) == nullptr && table.Resolve( third ) == nullptr );
+}
+
+template<typename Function>
+static double NanosecondsPerCall( size_t calls, Function function )
+{
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now( );
+	function( );
+	const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now( ) - start;
+	return elapsed.count( ) / static_cast<double>( calls );
+}
+
+// Every object is fetched through what its Lua userdata holds and its name
+// read, in random order, as Lua code calling methods on many objects would.
+static void Benchmark( size_t count )
+{
+	std::vector<Object> objects( count );
+	Table table;
+
+	struct Container
+	{
+		Object *raw;
+		Table::Handle handle;
+	};
+
+	std::vector<Container> containers( count );
+	for( size_t k = 0; k < count; ++k )
+	{
+		objects[k].name = k % 2 == 0 ? "even" : "odd";
+		containers[k].raw = &objects[k];
+		containers[k].handle = table.Acquire( &objects[k] );
+	}
+
+	std::shuffle( containers.begin( ), containers.end( ), std::mt19937( 11 ) );
+
+	const size_t rounds = 4000000 / count + 1;
+	size_t raw_sum = 0, checked_sum = 0;
+	const double raw_time = NanosecondsPerCall( rounds * count, [&]( )
+	{
+		for( size_t round = 0; round < rounds; ++round )
+			for( size_t k = 0; k < count; ++k )
+				raw_sum += static_cast<size_t>( containers[k].raw->name[0] );
+	} );
+	const double checked_time = NanosecondsPerCall( rounds * count, [&]( )
+	{
+		for( size_t round = 0; round < rounds; ++round )
+			for( size_t k = 0; k < count; ++k )
+			{
+				const Object *object = table.Resolve( containers[k].handle );
+				if( object != nullptr )
+					checked_sum += static_cast<size_t>( object->name[0] );
+			}
+	} );
+
+	CHECK( raw_sum == checked_sum );
+	std::printf( "%6lu objects: unchecked %5.2f ns, handle %5.2f ns per Get\n",
+		static_cast<unsigned long>( count ), raw_time, checked_time );
+}
+
+int main( )
+{
+	TestLifetime( );
+	if( failures != 0 )
+	{
+		std::fprintf( stderr, "%d checks failed\n", failures );
+		return EXIT_FAILURE;
+	}
+
+	Benchmark( 100 );
+	Benchmark( 5000 );
+	Benchmark( 20000 );
+	return failures != 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,41 @@
+-- Benchmark of method calls on concommand objects. It needs the game: install
+-- the module, copy this file to garrysmod/lua and run
+-- "lua_openscript methods.lua" on a server (or "lua_openscript_cl methods.lua"
+-- on a client).
+-- Objects without fields of their own look methods up in the shared
+-- metatable, which is its own __index. Storing a field moves an object to the
+-- C __index every object used before, which looks in the metatable and then
+-- in the object's environment. The same methods are timed on one object of
+-- each kind.
+
+require("concommandx")
+
+local calls = 1000000
+
+local function Time(object)
+	local sum = 0
+	local start = SysTime()
+	for i = 1, calls do
+		sum = sum + object:GetFlags()
+		if object:HasFlag(FCVAR_CHEAT) then
+			sum = sum + 1
+		end
+	end
+
+	return (SysTime() - start) / (calls * 2) * 1e9, sum
+end
+
+local plain = concommand.Create("concommandx_bench_plain", "", 0, function(args) end)
+local fielded = concommand.Create("concommandx_bench_fielded", "", 0, function(args) end)
+fielded.field = true
+assert(fielded.field == true and plain.field == nil)
+
+local plain_time, plain_sum = Time(plain)
+local fielded_time, fielded_sum = Time(fielded)
+assert(plain_sum == fielded_sum)
+
+print(string.format("method call: shared metatable %.1f ns, C __index %.1f ns (%.2fx)",
+	plain_time, fielded_time, fielded_time / plain_time))
+
+plain:Remove()
+fielded:Remove()
@@ -0,0 +1,281 @@
+// Tests and benchmark for the registry's name index. Standalone, build with
+//   c++ -std=c++11 -O2 -I../source nameindex.cpp -o nameindex
+// and run it, it exits non-zero and says why on failure, then prints how long
+// a lookup takes next to a walk of a mock ICvar list, which is how
+// ICvar::FindCommand finds a command.
+
+#include <nameindex.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+static int failures = 0;
+
+#define CHECK( condition ) \
+	do \
+	{ \
+		if( !( condition ) ) \
+		{ \
+			std::fprintf( stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition ); \
+			++failures; \
+		} \
+	} \
+	while( false )
+
+// Stands in for ConCommandBase, linked and named the same way, with a virtual
+// GetName and IsCommand like the walk in CCvar::FindCommandBase calls.
+struct Base
+{
+	virtual ~Base( ) { }
+
+	virtual bool IsCommand( ) const
+	{
+		return false;
+	}
+
+	virtual const char *GetName( ) const
+	{
+		return m_pszName;
+	}
+
+	Base *m_pNext;
+	const char *m_pszName;
+};
+
+struct Command : public Base
+{
+	virtual bool IsCommand( ) const
+	{
+		return true;
+	}
+};
+
+typedef NameIndex<Command> Index;
+
+static Command *Walk( Base *head, const char *name )
+{
+	for( Base *base = head; base != nullptr; base = base->m_pNext )
+		if( base->IsCommand( ) && Index::Equal( base->GetName( ), name ) )
+			return static_cast<Command *>( base );
+
+	return nullptr;
+}
+
+static void TestLookup( )
+{
+	std::vector<Command> commands( 4 );
+	const char *names[] = { "say", "Kick", "SAY", "status" };
+	for( size_t k = 0; k < commands.size( ); ++k )
+		commands[k].m_pszName = names[k];
+
+	std::vector<Command *> list;
+	for( size_t k = 0; k < commands.size( ); ++k )
+		list.push_back( &commands[k] );
+
+	Index index;
+	CHECK( index.Find( "say" ) == nullptr );
+
+	index.Rebuild( list );
+	// the first command under a name wins, like walking the list would
+	CHECK( index.Find( "say" ) == &commands[0] );
+	CHECK( index.Find( "SaY" ) == &commands[0] );
+	CHECK( index.Find( "kick" ) == &commands[1] );
+	CHECK( index.Find( "KICK" ) == &commands[1] );
+	CHECK( index.Find( "kic" ) == nullptr );
+	CHECK( index.Find( "kicks" ) == nullptr );
+	CHECK( index.Find( "" ) == nullptr );
+
+	// erasing a shadowed command says so and keeps the indexed one
+	CHECK( !index.Erase( &commands[2] ) );
+	CHECK( index.Find( "say" ) == &commands[0] );
+
+	// erasing the indexed one leaves the name free for the next command
+	CHECK( index.Erase( &commands[0] ) );
+	CHECK( index.Find( "say" ) == nullptr );
+	index.Insert( &commands[2] );
+	CHECK( index.Find( "say" ) == &commands[2] );
+
+	// inserting under a name already indexed changes nothing
+	index.Insert( &commands[0] );
+	CHECK( index.Find( "say" ) == &commands[2] );
+
+	index.Clear( );
+	CHECK( index.Find( "status" ) == nullptr );
+	CHECK( !index.Erase( &commands[3] ) );
+	index.Insert( &commands[3] );
+	CHECK( index.Find( "STATUS" ) == &commands[3] );
+}
+
+// Random inserts and erases over names that collide by case, checked against
+// a walk of the inserted commands in insertion order.
+static void TestRandom( )
+{
+	const size_t count = 600;
+	std::vector<std::string> names( count );
+	std::vector<Command> commands( count );
+	std::mt19937 random( 2024 );
+	for( size_t k = 0; k < count; ++k )
+	{
+		const size_t length = 1 + random( ) % 3;
+		for( size_t c = 0; c < length; ++c )
+			names[k] += "abAB"[random( ) % 4];
+
+		commands[k].m_pszName = names[k].c_str( );
+	}
+
+	Index index;
+	std::vector<Command *> present;
+	for( size_t round = 0; round < 20000; ++round )
+	{
+		Command *command = &commands[random( ) % count];
+		std::vector<Command *>::iterator it = std::find( present.begin( ), present.end( ), command );
+		if( it == present.end( ) )
+		{
+			present.push_back( command );
+			index.Insert( command );
+		}
+		else
+		{
+			Command *first = nullptr;
+			for( size_t k = 0; k < present.size( ) && first == nullptr; ++k )
+				if( Index::Equal( present[k]->m_pszName, command->m_pszName ) )
+					first = present[k];
+
+			CHECK( index.Erase( command ) == ( first == command ) );
+			present.erase( it );
+			// what the registry does after erasing the indexed command
+			if( first == command )
+				for( size_t k = 0; k < present.size( ); ++k )
+					if( Index::Equal( present[k]->m_pszName, command->m_pszName ) )
+					{
+						index.Insert( present[k] );
+						break;
+					}
+		}
+
+		if( round % 500 == 0 )
+			for( size_t k = 0; k < count; ++k )
+			{
+				Command *expected = nullptr;
+				for( size_t p = 0; p < present.size( ) && expected == nullptr; ++p )
+					if( Index::Equal( present[p]->m_pszName, names[k].c_str( ) ) )
+						expected = present[p];
+
+				CHECK( index.Find( names[k].c_str( ) ) == expected );
+			}
+	}
+
+	index.Rebuild( present );
+	for( size_t k = 0; k < present.size( ); ++k )
+		CHECK( Index::Equal( index.Find( present[k]->m_pszName )->m_pszName, present[k]->m_pszName ) );
+}
+
+template<typename Function>
+static double NanosecondsPerCall( size_t calls, Function function )
+{
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now( );
+	function( );
+	const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now( ) - start;
+	return elapsed.count( ) / static_cast<double>( calls );
+}
+
+// A list of commands with as many convars mixed in, prepended like ICvar
+// registers them, looked up by names in random order and differing case, plus
+// misses, which walk the whole list.
+static void Benchmark( size_t count )
+{
+	std::vector<std::string> names( count * 2 );
+	std::vector<Command> commands( count );
+	std::vector<Base> convars( count );
+	std::vector<Command *> list;
+	Base *head = nullptr;
+	for( size_t k = 0; k < count; ++k )
+	{
+		char name[32];
+		std::snprintf( name, sizeof( name ), "cmd_%lu_x", static_cast<unsigned long>( k ) );
+		names[k * 2] = name;
+		std::snprintf( name, sizeof( name ), "cvar_%lu_x", static_cast<unsigned long>( k ) );
+		names[k * 2 + 1] = name;
+
+		commands[k].m_pszName = names[k * 2].c_str( );
+		commands[k].m_pNext = head;
+		head = &commands[k];
+		convars[k].m_pszName = names[k * 2 + 1].c_str( );
+		convars[k].m_pNext = head;
+		head = &convars[k];
+		list.push_back( &commands[k] );
+	}
+
+	Index index;
+	index.Rebuild( list );
+
+	std::vector<std::string> hits( count ), misses( 256 );
+	for( size_t k = 0; k < count; ++k )
+	{
+		hits[k] = names[k * 2];
+		hits[k][0] = 'C';
+	}
+
+	for( size_t k = 0; k < misses.size( ); ++k )
+		misses[k] = "missing_" + std::to_string( k );
+
+	std::shuffle( hits.begin( ), hits.end( ), std::mt19937( 3 ) );
+
+	// the walk is slow enough that a sample of the hits does
+	const size_t walked = std::min<size_t>( count, 2000 );
+	const size_t rounds = 1000000 / count + 1;
+	size_t index_found = 0, walk_found = 0;
+	const double index_time = NanosecondsPerCall( rounds * walked, [&]( )
+	{
+		for( size_t round = 0; round < rounds; ++round )
+			for( size_t k = 0; k < walked; ++k )
+				index_found += index.Find( hits[k].c_str( ) ) != nullptr;
+	} );
+	const double walk_time = NanosecondsPerCall( walked, [&]( )
+	{
+		for( size_t k = 0; k < walked; ++k )
+			walk_found += Walk( head, hits[k].c_str( ) ) != nullptr;
+	} );
+
+	size_t index_missed = 0, walk_missed = 0;
+	const double index_miss_time = NanosecondsPerCall( rounds * misses.size( ), [&]( )
+	{
+		for( size_t round = 0; round < rounds; ++round )
+			for( size_t k = 0; k < misses.size( ); ++k )
+				index_missed += index.Find( misses[k].c_str( ) ) == nullptr;
+	} );
+	const double walk_miss_time = NanosecondsPerCall( misses.size( ), [&]( )
+	{
+		for( size_t k = 0; k < misses.size( ); ++k )
+			walk_missed += Walk( head, misses[k].c_str( ) ) == nullptr;
+	} );
+
+	CHECK( index_found == rounds * walked && walk_found == walked );
+	CHECK( index_missed == rounds * misses.size( ) && walk_missed == misses.size( ) );
+	for( size_t k = 0; k < walked; ++k )
+		CHECK( index.Find( hits[k].c_str( ) ) == Walk( head, hits[k].c_str( ) ) );
+
+	std::printf( "%6lu commands: hit index %6.1f ns, walk %9.1f ns; miss index %6.1f ns, walk %9.1f ns\n",
+		static_cast<unsigned long>( count ), index_time, walk_time, index_miss_time, walk_miss_time );
+}
+
+int main( )
+{
+	TestLookup( );
+	TestRandom( );
+	if( failures != 0 )
+	{
+		std::fprintf( stderr, "%d checks failed\n", failures );
+		return EXIT_FAILURE;
+	}
+
+	Benchmark( 1000 );
+	Benchmark( 5000 );
+	Benchmark( 10000 );
+	return failures != 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
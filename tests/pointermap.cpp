@@ -0,0 +1,149 @@
+// Tests and benchmark for the map behind the concommand object cache and the
+// registry's command IDs. Standalone, build with
+//   c++ -std=c++11 -O2 -I../source pointermap.cpp -o pointermap
+// and run it, it exits non-zero and says why on failure, then prints how long
+// a lookup takes with as many entries as a server has commands.
+// The Lua registry table lookups the map replaced in concommand::Push can't
+// run without the game, std::unordered_map is timed alongside as a reference.
+
+#include <pointermap.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+static int failures = 0;
+
+#define CHECK( condition ) \
+	do \
+	{ \
+		if( !( condition ) ) \
+		{ \
+			std::fprintf( stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition ); \
+			++failures; \
+		} \
+	} \
+	while( false )
+
+// Stands in for a ConCommand, keys are as far apart as real objects.
+struct Object
+{
+	char bytes[88];
+};
+
+// Random inserts, overwrites and erases, checked against std::unordered_map,
+// so backward shift deletion has to keep every probe chain intact.
+static void TestRandom( )
+{
+	std::vector<Object> objects( 4096 );
+	std::mt19937 random( 54321 );
+	PointerMap<int32_t> map;
+	std::unordered_map<const void *, int32_t> reference;
+	for( size_t round = 0; round < 200000; ++round )
+	{
+		const void *key = &objects[random( ) % objects.size( )];
+		switch( random( ) % 3 )
+		{
+			case 0:
+			case 1:
+			{
+				const int32_t value = static_cast<int32_t>( random( ) );
+				map.Insert( key, value );
+				reference[key] = value;
+				break;
+			}
+
+			case 2:
+				CHECK( map.Erase( key ) == ( reference.erase( key ) != 0 ) );
+				break;
+		}
+
+		if( round % 1000 == 0 )
+		{
+			CHECK( map.Size( ) == reference.size( ) );
+			for( size_t k = 0; k < objects.size( ); ++k )
+			{
+				const int32_t *found = map.Find( &objects[k] );
+				std::unordered_map<const void *, int32_t>::const_iterator it = reference.find( &objects[k] );
+				CHECK( ( found == nullptr ) == ( it == reference.end( ) ) );
+				if( found != nullptr && it != reference.end( ) )
+					CHECK( *found == it->second );
+			}
+		}
+	}
+
+	size_t visited = 0;
+	map.ForEach( [&visited, &reference]( const void *key, int32_t value )
+	{
+		CHECK( reference.at( key ) == value );
+		++visited;
+	} );
+	CHECK( visited == reference.size( ) );
+
+	map.Clear( );
+	CHECK( map.Size( ) == 0 && map.Find( &objects[0] ) == nullptr );
+}
+
+template<typename Function>
+static double NanosecondsPerCall( size_t calls, Function function )
+{
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now( );
+	function( );
+	const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now( ) - start;
+	return elapsed.count( ) / static_cast<double>( calls );
+}
+
+static void Benchmark( size_t count )
+{
+	std::vector<Object> objects( count );
+	std::vector<const void *> keys( count );
+	PointerMap<int32_t> map;
+	std::unordered_map<const void *, int32_t> reference;
+	for( size_t k = 0; k < count; ++k )
+	{
+		keys[k] = &objects[k];
+		map.Insert( keys[k], static_cast<int32_t>( k ) );
+		reference[keys[k]] = static_cast<int32_t>( k );
+	}
+
+	// looked up in random order, like objects pushed by Lua code
+	std::shuffle( keys.begin( ), keys.end( ), std::mt19937( 7 ) );
+
+	const size_t rounds = 2000000 / count + 1;
+	int64_t map_sum = 0, reference_sum = 0;
+	const double map_time = NanosecondsPerCall( rounds * count, [&]( )
+	{
+		for( size_t round = 0; round < rounds; ++round )
+			for( size_t k = 0; k < count; ++k )
+				map_sum += *map.Find( keys[k] );
+	} );
+	const double reference_time = NanosecondsPerCall( rounds * count, [&]( )
+	{
+		for( size_t round = 0; round < rounds; ++round )
+			for( size_t k = 0; k < count; ++k )
+				reference_sum += reference.find( keys[k] )->second;
+	} );
+
+	CHECK( map_sum == reference_sum );
+	std::printf( "%6lu entries: PointerMap::Find %6.1f ns, std::unordered_map::find %6.1f ns\n",
+		static_cast<unsigned long>( count ), map_time, reference_time );
+}
+
+int main( )
+{
+	TestRandom( );
+	if( failures != 0 )
+	{
+		std::fprintf( stderr, "%d checks failed\n", failures );
+		return EXIT_FAILURE;
+	}
+
+	Benchmark( 5000 );
+	Benchmark( 10000 );
+	Benchmark( 20000 );
+	return failures != 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,206 @@
+// Tests and benchmark for the trigram index behind concommand.Search.
+// Standalone, build with
+//   c++ -std=c++11 -O2 -I../source trigramindex.cpp -o trigramindex
+// and run it, it exits non-zero and says why on failure, then prints how long
+// a search takes over a mock registry next to what a Lua scan of it costs.
+// The Lua scan needs the game, so it is emulated by what it does per command:
+// copy the name and help text into new strings (GetName and GetHelpText),
+// lowercase both (string.lower) and look for the query in them
+// (string.find with plain set).
+
+#include <trigramindex.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+static int failures = 0;
+
+#define CHECK( condition ) \
+	do \
+	{ \
+		if( !( condition ) ) \
+		{ \
+			std::fprintf( stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition ); \
+			++failures; \
+		} \
+	} \
+	while( false )
+
+typedef std::vector<TrigramIndex::Match> Matches;
+
+static const TrigramIndex::Match *Find( const Matches &matches, uint32_t id )
+{
+	for( size_t k = 0; k < matches.size( ); ++k )
+		if( matches[k].id == id )
+			return &matches[k];
+
+	return nullptr;
+}
+
+static void TestQuery( )
+{
+	TrigramIndex index;
+	index.Add( "sv_cheats", "Allow cheats on server" );
+	index.Add( "kick", "Kick a player by name" );
+	index.Add( "CHEATCODE", nullptr );
+	index.Add( "ab", "" );
+
+	Matches matches;
+	index.Query( "cheat", matches );
+	// "che", "hea", "eat", all in the name of 0 and 2, and in the help of 0
+	CHECK( matches.size( ) == 2 );
+	const TrigramIndex::Match *first = Find( matches, 0 ), *third = Find( matches, 2 );
+	CHECK( first != nullptr && first->matched == 3 && first->name_matched == 3 );
+	CHECK( third != nullptr && third->matched == 3 && third->name_matched == 3 );
+
+	// help text only
+	index.Query( "PLAYER", matches );
+	CHECK( matches.size( ) == 1 && matches[0].id == 1 );
+	CHECK( matches[0].matched == 4 && matches[0].name_matched == 0 );
+
+	// half of the trigrams are enough, "kix" shares none with anything
+	index.Query( "kicx", matches );
+	CHECK( matches.size( ) == 1 && matches[0].id == 1 && matches[0].matched == 1 );
+	index.Query( "kixx", matches );
+	CHECK( matches.empty( ) );
+
+	// too short for trigrams, matched as substrings
+	index.Query( "AB", matches );
+	CHECK( matches.size( ) == 1 && matches[0].id == 3 && matches[0].name_matched == 1 );
+	index.Query( "na", matches );
+	CHECK( matches.size( ) == 1 && matches[0].id == 1 && matches[0].name_matched == 0 );
+
+	index.Clear( );
+	CHECK( index.Size( ) == 0 );
+	index.Query( "cheat", matches );
+	CHECK( matches.empty( ) );
+}
+
+static std::string Lower( const std::string &text )
+{
+	std::string lower( text );
+	for( size_t k = 0; k < lower.size( ); ++k )
+		if( lower[k] >= 'A' && lower[k] <= 'Z' )
+			lower[k] = static_cast<char>( lower[k] - 'A' + 'a' );
+
+	return lower;
+}
+
+struct Command
+{
+	std::string name;
+	std::string help;
+};
+
+static size_t Scan( const std::vector<Command> &commands, const std::string &query, std::vector<uint32_t> &hits )
+{
+	hits.clear( );
+	const std::string lower = Lower( query );
+	for( size_t id = 0; id < commands.size( ); ++id )
+	{
+		const std::string name = commands[id].name, help = commands[id].help;
+		if( Lower( name ).find( lower ) != std::string::npos ||
+			Lower( help ).find( lower ) != std::string::npos )
+			hits.push_back( static_cast<uint32_t>( id ) );
+	}
+
+	return hits.size( );
+}
+
+template<typename Function>
+static double NanosecondsPerCall( size_t calls, Function function )
+{
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now( );
+	function( );
+	const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now( ) - start;
+	return elapsed.count( ) / static_cast<double>( calls );
+}
+
+// Names and help texts are made of words from a small vocabulary, so queries
+// made of those words have plenty of hits and the index can't skip much.
+static void Benchmark( size_t count )
+{
+	const char *words[] = {
+		"player", "server", "client", "cheat", "Kick", "ban", "map", "Change", "weapon", "entity",
+		"Sound", "volume", "render", "debug", "network", "rate", "spawn", "model", "physics", "trace"
+	};
+	const size_t vocabulary = sizeof( words ) / sizeof( *words );
+	std::mt19937 random( 77 );
+
+	std::vector<Command> commands( count );
+	for( size_t k = 0; k < count; ++k )
+	{
+		commands[k].name = std::string( words[random( ) % vocabulary] ) + "_" +
+			words[random( ) % vocabulary] + "_" + std::to_string( k );
+		const size_t length = 4 + random( ) % 8;
+		for( size_t w = 0; w < length; ++w )
+		{
+			if( w != 0 )
+				commands[k].help += ' ';
+
+			commands[k].help += words[random( ) % vocabulary];
+		}
+	}
+
+	TrigramIndex index;
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now( );
+	for( size_t k = 0; k < count; ++k )
+		index.Add( commands[k].name.c_str( ), commands[k].help.c_str( ) );
+
+	const std::chrono::duration<double, std::milli> build = std::chrono::steady_clock::now( ) - start;
+
+	const char *queries[] = { "cheat", "kick player", "SERVER rate", "render_debug", "xyzzy", "spawn 42" };
+	const size_t query_count = sizeof( queries ) / sizeof( *queries );
+
+	// every scan hit contains all the query trigrams, so the index finds it
+	Matches matches;
+	std::vector<uint32_t> hits;
+	for( size_t q = 0; q < query_count; ++q )
+	{
+		index.Query( queries[q], matches );
+		Scan( commands, queries[q], hits );
+		for( size_t k = 0; k < hits.size( ); ++k )
+			CHECK( Find( matches, hits[k] ) != nullptr );
+	}
+
+	const size_t rounds = 20;
+	size_t index_sum = 0, scan_sum = 0;
+	const double index_time = NanosecondsPerCall( rounds * query_count, [&]( )
+	{
+		for( size_t round = 0; round < rounds; ++round )
+			for( size_t q = 0; q < query_count; ++q )
+			{
+				index.Query( queries[q], matches );
+				index_sum += matches.size( );
+			}
+	} );
+	const double scan_time = NanosecondsPerCall( rounds * query_count, [&]( )
+	{
+		for( size_t round = 0; round < rounds; ++round )
+			for( size_t q = 0; q < query_count; ++q )
+				scan_sum += Scan( commands, queries[q], hits );
+	} );
+
+	CHECK( index_sum >= scan_sum );
+	std::printf( "%6lu commands: index built in %.1f ms, search %8.1f us, Lua-like scan %8.1f us\n",
+		static_cast<unsigned long>( count ), build.count( ), index_time / 1000, scan_time / 1000 );
+}
+
+int main( )
+{
+	TestQuery( );
+	if( failures != 0 )
+	{
+		std::fprintf( stderr, "%d checks failed\n", failures );
+		return EXIT_FAILURE;
+	}
+
+	Benchmark( 1000 );
+	Benchmark( 10000 );
+	return failures != 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}